@@ -0,0 +1,171 @@
+/*******************************************************
+ * Beacon benchmark -- source file                     *
+ *                                                     *
+ * Author: agent                                       *
+ *                                                     *
+ * Date: 18:05 2026-10-18                              *
+ *                                                     *
+ * Description: Measures how fast a waiting pool       *
+ *              thread is woken up, and how bursts of  *
+ *              signals from many pool changes add up  *
+ *******************************************************/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "API.h"
+#include "Poller.h"
+
+using namespace AGSSockAPI;
+
+//------------------------------------------------------------------------------
+
+#ifndef _WIN32
+// The beacon as it used to be: a pipe that is written to for every signal
+struct PipeBeacon
+{
+	int fd[2];
+
+	PipeBeacon()
+	{
+		pipe(fd);
+		setblocking(fd[0], false);
+		setblocking(fd[1], false);
+	}
+	~PipeBeacon() { close(fd[0]); close(fd[1]); }
+
+	operator SOCKET() { return fd[0]; }
+
+	void reset()
+	{
+		char buffer[8];
+		while (read(fd[0], buffer, sizeof (buffer)) > 0);
+	}
+
+	void signal()
+	{
+		const char sig[] = "";
+		write(fd[1], sig, sizeof (sig));
+	}
+};
+#endif
+
+//------------------------------------------------------------------------------
+
+// Runs a thread that waits for the beacon like the pool does
+template <typename T> struct Waiter
+{
+	T beacon;
+	Poller poller;
+	std::atomic<size_t> wakes {0};
+	std::atomic<bool> done {false};
+	std::thread thread;
+
+	Waiter()
+	{
+		poller.add(beacon, nullptr);
+		thread = std::thread([this]() { run(); });
+	}
+
+	~Waiter()
+	{
+		done = true;
+		beacon.signal();
+		thread.join();
+	}
+
+	void run()
+	{
+		Poller::Event events[64];
+		while (!done)
+			if (poller.wait(events, 64) > 0)
+			{
+				beacon.reset();
+				++wakes;
+			}
+	}
+};
+
+//------------------------------------------------------------------------------
+
+// Signals a waiting thread and spins until it woke up; returns the median
+// round trip in microseconds.
+template <typename T> double wake_latency(size_t repeat)
+{
+	using namespace std::chrono;
+
+	Waiter<T> waiter;
+	std::this_thread::sleep_for(milliseconds(10));
+
+	std::vector<double> times;
+	for (size_t i = 0; i < repeat; ++i)
+	{
+		size_t wakes = waiter.wakes;
+		auto start = steady_clock::now();
+		waiter.beacon.signal();
+		while (waiter.wakes == wakes);
+		auto stop = steady_clock::now();
+		times.push_back(duration_cast<nanoseconds>(stop - start).count() / 1e3);
+	}
+
+	std::sort(times.begin(), times.end());
+	return times[times.size() / 2];
+}
+
+//------------------------------------------------------------------------------
+
+// Signals a burst of changes, like accepting many connections at once; returns
+// the time the signals took in microseconds and the wake-ups they caused.
+template <typename T> double signal_burst(size_t count, size_t &wakes)
+{
+	using namespace std::chrono;
+
+	Waiter<T> waiter;
+	std::this_thread::sleep_for(milliseconds(10));
+
+	auto start = steady_clock::now();
+	for (size_t i = 0; i < count; ++i)
+		waiter.beacon.signal();
+	auto stop = steady_clock::now();
+
+	std::this_thread::sleep_for(milliseconds(10));
+	wakes = waiter.wakes;
+	return duration_cast<nanoseconds>(stop - start).count() / 1e3;
+}
+
+//------------------------------------------------------------------------------
+
+int main(int argc, char const *argv[])
+{
+	Initialize();
+
+	// The beacon should wake a thread at least as fast as a pipe does
+	std::printf("%10s %14s\n", "beacon", "us/wake-up");
+	std::printf("%10s %14.1f\n", "coalesced", wake_latency<Beacon>(10000));
+#ifndef _WIN32
+	std::printf("%10s %14.1f\n", "pipe", wake_latency<PipeBeacon>(10000));
+#endif
+
+	// A burst of signals should cost a single wake-up and hardly any time
+	size_t wakes;
+	std::printf("\n%10s %10s %14s %10s\n", "beacon", "signals", "us/burst", "wake-ups");
+	for (size_t count = 10; count <= 1000; count *= 10)
+	{
+		double time = signal_burst<Beacon>(count, wakes);
+		std::printf("%10s %10zu %14.1f %10zu\n", "coalesced", count, time, wakes);
+	#ifndef _WIN32
+		time = signal_burst<PipeBeacon>(count, wakes);
+		std::printf("%10s %10zu %14.1f %10zu\n", "pipe", count, time, wakes);
+	#endif
+	}
+
+	Terminate();
+	return EXIT_SUCCESS;
+}
+
+//..............................................................................
@@ -0,0 +1,169 @@
+/*******************************************************
+ * Socket buffer benchmark -- source file              *
+ *                                                     *
+ * Author: agent                                       *
+ *                                                     *
+ * Date: 11:20 2026-10-18                              *
+ *                                                     *
+ * Description: Measures how reading bursts of small   *
+ *              stream messages scales and how fast    *
+ *              delimiters are found in large backlogs *
+ *******************************************************/
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include "Buffer.h"
+#include "Scan.h"
+
+using namespace AGSSock;
+
+//------------------------------------------------------------------------------
+
+// Receives a burst of count messages in 64K reads and drains it like
+// Socket.Recv does; returns the time it took in nanoseconds per message.
+double drain_burst(size_t count)
+{
+	using namespace std::chrono;
+
+	std::string burst;
+	for (size_t i = 0; i < count; ++i)
+	{
+		burst += "message ";
+		burst += std::to_string(i);
+		burst += '\0';
+	}
+
+	Buffer buffer;
+	for (size_t pos = 0; pos < burst.size(); pos += 65536)
+		buffer.append(burst.data() + pos, burst.size() - pos < 65536
+			? burst.size() - pos : 65536);
+
+	size_t drained = 0, size = 0;
+	auto start = steady_clock::now();
+	while (!buffer.empty())
+	{
+		size += std::string(buffer.message()).size();
+		buffer.extract();
+		++drained;
+	}
+	auto stop = steady_clock::now();
+
+	if (drained != count || !size)
+	{
+		std::printf("unexpected result: %zu of %zu messages\n", drained, count);
+		std::exit(EXIT_FAILURE);
+	}
+
+	return duration_cast<nanoseconds>(stop - start).count() / (double) count;
+}
+
+//------------------------------------------------------------------------------
+
+// Searches a backlog of size bytes for a delimiter at its very end, repeatedly;
+// returns the throughput in megabytes per second.
+double scan_backlog(size_t size, const std::string &delimiter)
+{
+	using namespace std::chrono;
+
+	std::string backlog(size, 'x');
+	backlog.replace(size - delimiter.size(), delimiter.size(), delimiter);
+	const int repeat = 20;
+
+	size_t found = 0;
+	auto start = steady_clock::now();
+	for (int i = 0; i < repeat; ++i)
+		found += scan(backlog.data(), backlog.data() + size,
+			delimiter.data(), delimiter.size()) - backlog.data();
+	auto stop = steady_clock::now();
+
+	if (found != (size - delimiter.size()) * repeat)
+	{
+		std::printf("unexpected result: delimiter not found\n");
+		std::exit(EXIT_FAILURE);
+	}
+
+	double seconds = duration_cast<nanoseconds>(stop - start).count() / 1e9;
+	return size * repeat / seconds / 1e6;
+}
+
+//------------------------------------------------------------------------------
+
+// Receives bursts of reads of the given amount like the pool does, either
+// copying them into the buffer or handing over the string read into, then
+// takes them out like Socket.RecvData does; returns nanoseconds per read.
+double hand_over(size_t amount, bool handoff)
+{
+	using namespace std::chrono;
+
+	Buffer buffer;
+	Bytes chunk, data;
+	const size_t burst = 64, count = (256 << 20) / amount / burst * burst;
+
+	size_t received = 0;
+	auto start = steady_clock::now();
+	for (size_t i = 0; i < count; i += burst)
+	{
+		for (size_t j = 0; j < burst; ++j)
+		{
+			chunk.resize(amount);
+			chunk[0] = chunk[amount - 1] = (char) j;
+			if (handoff)
+				buffer.push(chunk);
+			else
+				buffer.push(chunk.data(), amount);
+		}
+
+		while (!buffer.empty())
+		{
+			data.swap(buffer.front());
+			received += data.size();
+			buffer.pop();
+		}
+	}
+	auto stop = steady_clock::now();
+
+	if (received != count * amount)
+	{
+		std::printf("unexpected result: %zu of %zu bytes\n", received,
+			count * amount);
+		std::exit(EXIT_FAILURE);
+	}
+
+	return duration_cast<nanoseconds>(stop - start).count() / (double) count;
+}
+
+//------------------------------------------------------------------------------
+
+int main(int argc, char const *argv[])
+{
+	// The time per message should remain about the same as bursts grow
+	std::printf("%10s %14s\n", "messages", "ns/message");
+	for (size_t count = 1000; count <= 1024000; count *= 4)
+		std::printf("%10zu %14.1f\n", count, drain_burst(count));
+
+	// Delimiters of either length should be found about as fast as memchr
+	// goes, whose vectorized search the scan relies on
+	std::printf("\n%10s %14s %14s\n", "backlog", "\\n", "\\r\\n");
+	for (size_t size = 1 << 20; size <= 16 << 20; size *= 4)
+		std::printf("%9zuM %11.0fMB/s %11.0fMB/s\n", size >> 20,
+			scan_backlog(size, "\n"), scan_backlog(size, "\r\n"));
+
+	// Handing over saves the copy, but the next read has to fill a fresh
+	// string; only large reads make up for that (see Pool::HANDOFF)
+	std::printf("\n%10s %14s %14s\n", "read", "copy ns", "handoff ns");
+	for (size_t amount : {4, 8, 16, 24, 32, 48, 64, 128})
+		std::printf("%9zuK %14.0f %14.0f\n", amount,
+			hand_over(amount << 10, false), hand_over(amount << 10, true));
+
+	// Nearly all message memory should have been recycled
+	Slab::Statistics stats = Slab::statistics();
+	std::printf("\nslab: %zu hits, %zu misses, %zuK held\n",
+		stats.hits, stats.misses, stats.held >> 10);
+
+	return EXIT_SUCCESS;
+}
+
+//..............................................................................
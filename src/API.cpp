@@ -5,6 +5,15 @@
 #include <cassert>
 #include <cstddef>
 #include <cstdlib>
+#include <vector>
+
+#ifdef HAVE_EVENTFD
+	#include <sys/eventfd.h>
+#endif
+
+#ifndef _WIN32
+	#include <poll.h>
+#endif
 
 #include "API.h"
 
@@ -45,7 +54,8 @@ AGAIN, WOULDBLOCK, ALREADY, INPROGRESS, INTR:     PleaseTryAgain
 BADF, NOTSOCK:                                    SocketNotValid
 CONNABORTED, CONNREFUSED, CONNRESET, NETRESET:    Disconnected
 DESTADDRREQ, INVAL, PROTOTYPE, FAULT, ISCONN:     Invalid
-OPNOTSUPP, PROTO, PROTONOSUPPORT, SOCKTNOSUPPORT: Unsupported
+OPNOTSUPP, PROTO, PROTONOSUPPORT, SOCKTNOSUPPORT,
+NOPROTOOPT:                                       Unsupported
 HOSTUNREACH:                                      HostUnreachable
 MFILE, NFILE, NOBUFS, NOMEM:                      NotEnoughResources
 NETDOWN, NETUNREACH:                              NetworkUnreachable
@@ -101,6 +111,7 @@ ags_t AGSEnumerateError(int errnum)
 		NOT_WIN(case ERR(PROTO):)
 		case ERR(PROTONOSUPPORT):
 		case ERR(SOCKTNOSUPPORT):
+		case ERR(NOPROTOOPT):
 		                          return AGSSOCK_UNSUPPORTED;
 		case ERR(HOSTUNREACH):
 		                          return AGSSOCK_HOST_NOT_REACHED;
@@ -304,12 +315,21 @@ void Thread::exit()
 		For now I go for the second implementation since it will not be called
 		very often.
 
+	Elsewhere a pipe is used, or an eventfd on Linux: a single counter that
+	is set and cleared with one system call each, no matter how often it was
+	signalled.
+
+	In all cases only the first signal after a reset touches the socket.
+	On Windows that may close it while it is being replaced, so both take a
+	lock there; elsewhere the descriptors never change.
+
 */
 
 #define IMPL_MODE 2
 
 Beacon::Beacon()
 {
+	data.pending = false;
 #if defined(_WIN32) && (IMPL_MODE == 1)
 	data.fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
 	setblocking(data.fd, false);
@@ -323,6 +343,8 @@ Beacon::Beacon()
 #elif defined(_WIN32) && (IMPL_MODE == 2)
 	data.fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
 	setblocking(data.fd, false);
+#elif defined(HAVE_EVENTFD)
+	data.fd[0] = data.fd[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
 #else
 	pipe(data.fd);
 	setblocking(data.fd[0], false);
@@ -338,7 +360,8 @@ Beacon::~Beacon()
 	closesocket(data.fd);
 #else
 	close(data.fd[0]);
-	close(data.fd[1]);
+	if (data.fd[1] != data.fd[0])
+		close(data.fd[1]);
 #endif
 }
 
@@ -346,29 +369,45 @@ Beacon::~Beacon()
 
 void Beacon::reset()
 {
+	// Drained first: a signal that arrives meanwhile still sees the beacon
+	// pending and is coalesced, which is fine as the listening party checks
+	// for changes after the reset. Clearing first would let the drain swallow
+	// a signal that then leaves the beacon pending, and silent, for good.
 #if defined(_WIN32) && (IMPL_MODE == 1)
 	char buffer[8];
 	while (recv(data.fd, buffer, sizeof (buffer), 0) > 0);
 #elif defined(_WIN32) && (IMPL_MODE == 2)
+	Mutex::Lock lock(data.mutex);
 	closesocket(data.fd);
 	data.fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
 	setblocking(data.fd, false);
+#elif defined(HAVE_EVENTFD)
+	eventfd_t value;
+	eventfd_read(data.fd[0], &value);
 #else
 	char buffer[8];
 	while (read(data.fd[0], buffer, sizeof (buffer)) > 0);
 #endif
+	data.pending = false;
 }
 
 //------------------------------------------------------------------------------
 
 void Beacon::signal()
 {
-	const char sig[] = "";
+	if (data.pending.exchange(true))
+		return;
+
 #if defined(_WIN32) && (IMPL_MODE == 1)
+	const char sig[] = "";
 	send(data.fd, sig, sizeof (sig), 0);
 #elif defined(_WIN32) && (IMPL_MODE == 2)
+	Mutex::Lock lock(data.mutex);
 	closesocket(data.fd);
+#elif defined(HAVE_EVENTFD)
+	eventfd_write(data.fd[1], 1);
 #else
+	const char sig[] = "";
 	write(data.fd[1], sig, sizeof (sig));
 #endif
 }
@@ -470,4 +509,39 @@ int setblocking(SOCKET sock, bool state)
 #endif
 }
 
+//------------------------------------------------------------------------------
+
+size_t waitreadable(const SOCKET *socks, size_t count, long timeout)
+{
+#ifdef _WIN32
+	fd_set read;
+	FD_ZERO(&read);
+	for (size_t i = 0; i < count && i < FD_SETSIZE; ++i)
+		FD_SET(socks[i], &read);
+
+	timeval time = {timeout / 1000, (timeout % 1000) * 1000};
+	int ret = select(0, &read, nullptr, nullptr, timeout < 0 ? nullptr : &time);
+	if (ret < 0)
+		return 0;
+	for (size_t i = 0; i < count && ret > 0; ++i)
+		if (FD_ISSET(socks[i], &read))
+			return i;
+	return count;
+#else
+	// Note: only the calling thread uses this, so it is kept for the next call
+	thread_local std::vector<pollfd> fds;
+	fds.resize(count);
+	for (size_t i = 0; i < count; ++i)
+		fds[i] = {socks[i], POLLIN, 0};
+
+	int ret = poll(fds.data(), fds.size(), timeout < 0 ? -1 : (int) timeout);
+	if (ret < 0)
+		return 0;
+	for (size_t i = 0; i < count && ret > 0; ++i)
+		if (fds[i].revents)
+			return i;
+	return count;
+#endif
+}
+
 //..............................................................................
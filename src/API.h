@@ -44,6 +44,8 @@
 	#define WOULD_BLOCK(x) ((x) == WSAEWOULDBLOCK)
 	#define ALREADY(x) ((x) == WSAEALREADY || (x) == WSAEINVAL || (x) == WSAEWOULDBLOCK)
 	#define GET_ERROR() WSAGetLastError()
+	#define SET_ERROR(x) WSASetLastError(WSAE ## x)
+	#define SET_ERROR_CODE(x) WSASetLastError(x)
 	#define RESET_ERROR()
 	#define ADDRLEN int
 	#define ADDR_SIZE(x) (sizeof (SOCKADDR_STORAGE))
@@ -55,6 +57,8 @@
 	#include <sys/types.h>
 	#include <sys/socket.h>
 	#include <arpa/inet.h>
+	#include <netinet/in.h>
+	#include <netinet/tcp.h>
 	#include <netdb.h>
 	#include <pthread.h>
 	#include <time.h>
@@ -82,6 +86,8 @@
 	#define WOULD_BLOCK(x) ((x) == EAGAIN || (x) == EWOULDBLOCK)
 	#define ALREADY(x) ((x) == EINPROGRESS || (x) == EALREADY)
 	#define GET_ERROR() errno
+	#define SET_ERROR(x) do {errno = E ## x;} while (0)
+	#define SET_ERROR_CODE(x) do {errno = (x);} while (0)
 	#define RESET_ERROR() do {errno = 0;} while (0)
 #endif
 
@@ -89,6 +95,11 @@
 #define CONST_ADDR(x) (reinterpret_cast<const sockaddr *> (x))
 
 int setblocking(SOCKET sock, bool state);
+//! Waits until any of the sockets has something to read, or fails
+//! \param timeout in milliseconds, negative to wait indefinitely
+//! \return the index of the socket, or count if the timeout passed
+//! \note If waiting itself fails, the first socket is reported.
+size_t waitreadable(const SOCKET *socks, size_t count, long timeout);
 
 #ifndef MIN
 	#define MIN(a,b) (((a)<(b)) ? (a) : (b))
@@ -96,6 +107,7 @@ int setblocking(SOCKET sock, bool state);
 
 //------------------------------------------------------------------------------
 
+#include <atomic>
 #include <cstdint>
 #include <functional>
 
@@ -252,6 +264,10 @@ class Thread
 //------------------------------------------------------------------------------
 
 //! Inter-thread signalling class
+
+//! Signals are coalesced: until the beacon is reset, signalling it again
+//! costs nothing. Any thread may signal, also while the listening party
+//! resets the beacon.
 class Beacon
 {
 	public:
@@ -269,7 +285,9 @@ class Beacon
 		#endif
 	}
 	
-	void reset();  //!< Resets the beacon after use for re-use
+	//! Resets the beacon after use for re-use
+	//! \note The socket it presents may change.
+	void reset();
 	void signal(); //!< Signals the listening party
 
 	Beacon(const Beacon &) = delete;
@@ -280,9 +298,11 @@ class Beacon
 	{
 		#ifdef _WIN32
 			SOCKET fd;
+			Mutex mutex; //!< Guards fd, which signalling may close
 		#else
-			int fd[2];
+			int fd[2]; //!< Both the same for an eventfd
 		#endif
+		std::atomic<bool> pending; //!< Whether signalled since the reset
 	} data;
 };
 
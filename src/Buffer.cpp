@@ -2,26 +2,353 @@
  * Data buffer class -- See header file for more information. *
  **************************************************************/
 
+#include <algorithm>
+
 #include "Buffer.h"
+#include "Scan.h"
 
 namespace AGSSock {
 
+using std::memory_order_relaxed;
+using std::memory_order_acquire;
+using std::memory_order_release;
+using std::memory_order_acq_rel;
+
 //------------------------------------------------------------------------------
 
-void Buffer::extract()
+Buffer::Buffer()
+	: index_(0), offset_(0), length_(0), searched_(0), staged_(false),
+	  joinable_(false), sourced_(false), spare_(nullptr), stored_(0),
+	  removed_(0), error(0)
+{
+	head_ = tail_ = new Ring();
+}
+
+Buffer::~Buffer()
+{
+	while (head_ != nullptr)
+	{
+		Ring *ring = head_;
+		head_ = ring->next.load(memory_order_relaxed);
+		delete ring;
+	}
+	delete spare_.load(memory_order_relaxed);
+}
+
+//------------------------------------------------------------------------------
+
+Buffer::Segment &Buffer::reserve()
+{
+	size_t tail = tail_->tail.load(memory_order_relaxed);
+	if (tail == Ring::SIZE)
+	{
+		// The ring is full, continue in a fresh one
+		Ring *ring = spare_.exchange(nullptr, memory_order_acquire);
+		if (ring == nullptr)
+			ring = new Ring();
+		tail_->next.store(ring, memory_order_release);
+		tail_ = ring;
+		tail = 0;
+	}
+	return tail_->segments[tail];
+}
+
+//------------------------------------------------------------------------------
+
+void Buffer::publish(Segment &segment, bool joinable,
+	const SOCKADDR_STORAGE *source)
+{
+	segment.joinable = joinable;
+	segment.sourced = (source != nullptr);
+	if (source != nullptr)
+		segment.source = *source;
+
+	// Counted before publishing, so the consumer never removes more
+	stored_.store(stored_.load(memory_order_relaxed) + segment.data.size(),
+		memory_order_relaxed);
+
+	size_t tail = tail_->tail.load(memory_order_relaxed);
+	tail_->tail.store(tail + 1, memory_order_release);
+}
+
+//------------------------------------------------------------------------------
+
+void Buffer::write(const char *data, size_t count, bool joinable,
+	const SOCKADDR_STORAGE *source)
+{
+	Segment &segment = reserve();
+	segment.data.assign(data, count);
+	publish(segment, joinable, source);
+}
+
+void Buffer::write(string &data, bool joinable, const SOCKADDR_STORAGE *source)
 {
+	// The storage of a consumed element is handed back for reuse
+	Segment &segment = reserve();
+	segment.data.swap(data);
+	data.clear();
+	publish(segment, joinable, source);
+}
+
+//------------------------------------------------------------------------------
+
+Buffer::Segment *Buffer::peek()
+{
+	if (index_ == Ring::SIZE)
+	{
+		Ring *next = head_->next.load(memory_order_acquire);
+		if (next == nullptr)
+			return nullptr;
+
+		// The producer moved on, so the drained ring can be reused
+		head_->tail.store(0, memory_order_relaxed);
+		head_->next.store(nullptr, memory_order_relaxed);
+		delete spare_.exchange(head_, memory_order_acq_rel);
+		head_ = next;
+		index_ = 0;
+	}
+
+	if (index_ < head_->tail.load(memory_order_acquire))
+		return &head_->segments[index_];
+	return nullptr;
+}
+
+//------------------------------------------------------------------------------
+
+void Buffer::stage()
+{
+	Segment *segment;
+
 	// Not checked for empty
-	string &buffer = queue_.front();
-	size_t pos = buffer.find_first_of('\0');
-	if (pos == string::npos)
-		queue_.pop();
+	if (!staged_)
+	{
+		segment = peek();
+		front_.swap(segment->data);
+		segment->data.clear();
+		length_ = front_.size();
+		joinable_ = segment->joinable;
+		// The segment may be reused once consumed, so the address is copied
+		sourced_ = segment->sourced;
+		if (sourced_)
+			source_ = segment->source;
+		staged_ = true;
+		++index_;
+	}
+
+	// Extracted data is dropped before it outgrows what remains
+	if (joinable_ && offset_ > front_.size() / 2)
+	{
+		front_.erase(0, offset_);
+		length_ -= offset_;
+		offset_ = 0;
+	}
+
+	// Streams are concatenated as far as they have been received
+	while (joinable_ && (segment = peek()) && segment->joinable)
+	{
+		front_.append(segment->data);
+		length_ += segment->data.size();
+		segment->data.clear();
+		++index_;
+	}
+}
+
+//------------------------------------------------------------------------------
+
+Buffer::string &Buffer::front()
+{
+	stage();
+	if (offset_ > 0)
+	{
+		front_.erase(0, offset_);
+		length_ -= offset_;
+		offset_ = 0;
+	}
+	return front_;
+}
+
+//------------------------------------------------------------------------------
+
+bool Buffer::empty()
+{
+	return !staged_ && peek() == nullptr;
+}
+
+//------------------------------------------------------------------------------
+
+void Buffer::pop()
+{
+	// Data that arrived after front was accessed should not be dropped
+	if (!staged_)
+		stage();
+	// Note: the caller may have taken the data from front_ already
+	removed_.store(removed_.load(memory_order_relaxed) + length_ - offset_,
+		memory_order_relaxed);
+	front_.clear();
+	offset_ = 0;
+	length_ = 0;
+	searched_ = 0;
+	staged_ = false;
+}
+
+//------------------------------------------------------------------------------
+
+void Buffer::extract()
+{
+	if (!staged_)
+		stage();
+
+	const char *begin = front_.data();
+	const char *end = begin + front_.size();
+	const char *pos = scan(begin + offset_, end, '\0');
+	if (pos == end)
+		pop();
 	else
 	{
-		pos = buffer.find_first_not_of('\0', pos);
-		buffer.erase(0, pos);
+		size_t next = front_.find_first_not_of('\0', pos - begin);
 		// Empty strings should only be generated by the sockets API
-		if (buffer.empty())
-			queue_.pop();
+		if (next == string::npos)
+			pop();
+		else
+			skip(next - offset_);
+	}
+}
+
+//------------------------------------------------------------------------------
+
+void Buffer::skip(size_t count)
+{
+	offset_ += count;
+	removed_.store(removed_.load(memory_order_relaxed) + count,
+		memory_order_relaxed);
+}
+
+//------------------------------------------------------------------------------
+
+bool Buffer::extract(const std::string &delimiter, std::string &message)
+{
+	for (;;)
+	{
+		if (!staged_ && peek() == nullptr)
+			return false;
+		stage();
+
+		const char *begin = front_.data() + offset_;
+		const char *end = front_.data() + front_.size();
+		const char *pos = scan(begin + searched_, end,
+			delimiter.data(), delimiter.size());
+
+		if (pos == end)
+		{
+			// Wait for the rest of the message if more data is to be expected
+			if (joinable_ && peek() == nullptr)
+			{
+				// Note: the delimiter might be split over two receives
+				searched_ = end - begin;
+				searched_ -= std::min(searched_, delimiter.size() - 1);
+				return false;
+			}
+
+			message.assign(begin, end);
+			pop();
+			return true;
+		}
+
+		bool found = (pos != begin);
+		if (found)
+			message.assign(begin, pos);
+
+		skip(pos - begin + delimiter.size());
+		searched_ = 0;
+		if (offset_ == front_.size())
+			pop();
+
+		if (found)
+			return true;
+	}
+}
+
+//------------------------------------------------------------------------------
+
+bool Buffer::complete(const std::string &delimiter)
+{
+	if (!staged_ && peek() == nullptr)
+		return false;
+	stage();
+
+	// The end of the stream or another element ends the message as well
+	if (!joinable_ || peek() != nullptr)
+		return true;
+
+	const char *begin = front_.data() + offset_;
+	const char *end = front_.data() + front_.size();
+	size_t size = delimiter.size();
+
+	// Empty messages are skipped by extract, so their delimiters end nothing
+	const char *start = begin + searched_;
+	if (!searched_)
+		while ((size_t) (end - start) >= size
+			&& std::equal(start, start + size, delimiter.data()))
+			start += size;
+
+	if (scan(start, end, delimiter.data(), size) != end)
+		return true;
+
+	// Note: like extract, the delimiter might be split over two receives
+	if (start == begin)
+	{
+		searched_ = end - begin;
+		searched_ -= std::min(searched_, size - 1);
+	}
+	return false;
+}
+
+//------------------------------------------------------------------------------
+
+size_t Buffer::gather(Chunk *chunks, size_t count)
+{
+	size_t ret = 0;
+
+	if (staged_ && ret < count)
+		chunks[ret++] = {front_.data() + offset_, front_.size() - offset_};
+
+	// The segments are not taken off the queue yet
+	Ring *ring = head_;
+	size_t index = index_;
+	while (ret < count)
+	{
+		if (index == Ring::SIZE)
+		{
+			ring = ring->next.load(memory_order_acquire);
+			if (ring == nullptr)
+				break;
+			index = 0;
+		}
+		if (index >= ring->tail.load(memory_order_acquire))
+			break;
+
+		const string &data = ring->segments[index++].data;
+		chunks[ret++] = {data.data(), data.size()};
+	}
+
+	return ret;
+}
+
+//------------------------------------------------------------------------------
+
+void Buffer::consume(size_t size)
+{
+	while (size > 0 && !empty())
+	{
+		stage();
+		size_t left = front_.size() - offset_;
+		if (size < left)
+		{
+			skip(size);
+			return;
+		}
+		size -= left;
+		pop();
 	}
 }
 
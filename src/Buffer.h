@@ -13,10 +13,13 @@
 #ifndef _BUFFER_H
 #define _BUFFER_H
 
+#include <atomic>
 #include <cstddef>
-#include <queue>
 #include <string>
 
+#include "API.h"
+#include "Slab.h"
+
 namespace AGSSock {
 
 //------------------------------------------------------------------------------
@@ -24,50 +27,172 @@ namespace AGSSock {
 //! Socket buffer
 
 //! A data structure that enqueues both packet based and streaming data.
+//! The buffer is a lock-free single producer, single consumer queue: one
+//! thread may push and append while another one accesses the front and
+//! removes elements, without further synchronization.
+//! \note push, append and error are the producer's; the rest the consumer's.
 class Buffer
 {
-	using string = std::string;
+	using string = Bytes;
 
-	std::queue<string> queue_;
+	//! Describes a data-string in the queue
+	struct Segment
+	{
+		string data;
+		bool joinable; //!< Whether it continues the previous stream segment
+		bool sourced;  //!< Whether the source address is known
+		SOCKADDR_STORAGE source; //!< Address of the sender of a datagram
+	};
+
+	//! Fixed size ring of segments; rings are chained when the producer
+	//! outpaces the consumer.
+	struct Ring
+	{
+		enum { SIZE = 32 };
+
+		Segment segments[SIZE];
+		std::atomic<size_t> tail; //!< Amount of segments published
+		std::atomic<Ring *> next; //!< Ring the producer continued in
+
+		Ring() : tail(0), next(nullptr) {}
+	};
+
+	// Consumer side
+	Ring *head_;         //!< Ring currently consumed
+	size_t index_;       //!< Next segment to consume in the head ring
+	string front_;       //!< The element taken off the queue
+	size_t offset_;      //!< Amount of front_ that was already extracted
+	size_t length_;      //!< Amount of data staged in front_, as counted
+	size_t searched_;    //!< Amount after offset_ known to hold no delimiter
+	bool staged_;        //!< Whether front_ holds an element
+	bool joinable_;      //!< Whether front_ may still be extended
+	bool sourced_;       //!< Whether source_ holds the sender of front_
+	SOCKADDR_STORAGE source_; //!< The sender of front_, if known
+
+	// Producer side
+	Ring *tail_;         //!< Ring currently produced in
+
+	std::atomic<Ring *> spare_; //!< Drained ring kept for reuse
+
+	// Note: each counter is only written by one side
+	std::atomic<size_t> stored_;  //!< Amount of data added by the producer
+	std::atomic<size_t> removed_; //!< Amount of data removed by the consumer
+
+	Segment &reserve(); //!< Returns the segment to write next
+	void publish(Segment &, bool joinable, const SOCKADDR_STORAGE *source);
+	void write(const char *data, size_t count, bool joinable,
+		const SOCKADDR_STORAGE *source = nullptr);
+	void write(string &data, bool joinable, const SOCKADDR_STORAGE *source);
+	Segment *peek();
+	void stage();
+	void skip(size_t count); //!< Extracts data from the staged element
 
 	public:
-	int error; //!< A potential error code the last operation caused
-	
-	Buffer() : error(0) {}
+	//! A potential error code the last operation caused
+	//! \note Check this before checking for emptiness; data that was stored
+	//! before the error is then guaranteed to be seen.
+	std::atomic<int> error;
+
+	Buffer();
+	~Buffer();
 
 	//! Access the first element of the buffer
-	inline string &front()
-		{ return queue_.front(); }
-	inline const string &front() const
-		{ return queue_.front(); }
+	//! \note Stream data that arrived since the last access is appended to it.
+	//! \warning The buffer should not be empty.
+	string &front();
+
+	//! Returns the first zero-terminated string of the first element
+	//! \note Unlike front() this does not move previously extracted data.
+	//! \warning The buffer should not be empty.
+	inline const char *message()
+		{ stage(); return front_.c_str() + offset_; }
 
 	//! Returns if the buffer is empty
-	inline bool empty() const
-		{ return queue_.empty(); }
+	bool empty();
+
+	//! Returns the amount of data stored, which either side may ask for
+	//! \note Data extracted from the first element counts as removed, even
+	//! if front() was not accessed since.
+	inline size_t size() const
+	{
+		size_t removed = removed_.load(std::memory_order_relaxed);
+		return stored_.load(std::memory_order_relaxed) - removed;
+	}
+
+	//! Returns the amount of data removed so far, for the consumer to tell
+	//! how much an operation removed.
+	inline size_t removed() const
+		{ return removed_.load(std::memory_order_relaxed); }
 
 	//! Adds a new data-string to the buffer (back)
-	inline void push(const char *data, size_t count)
-		{ queue_.push(string(data, count)); }
+	//! \param source the address the data was received from, if known
+	inline void push(const char *data, size_t count,
+		const SOCKADDR_STORAGE *source = nullptr)
+		{ write(data, count, false, source); }
+
+	//! Moves a data-string into the buffer (back) without copying it
+	//! \note data is left empty, but may hold storage that can be reused.
+	inline void push(string &data, const SOCKADDR_STORAGE *source = nullptr)
+		{ write(data, false, source); }
+
+	//! Returns the address the first element was received from
+	//! \return nullptr if it was not pushed along with its source.
+	//! \warning The buffer should not be empty.
+	inline const SOCKADDR_STORAGE *source()
+		{ stage(); return sourced_ ? &source_ : nullptr; }
 
 	//! Removes the first element of the buffer
-	inline void pop()
-		{ queue_.pop(); }
-	
+	//! \warning The buffer should not be empty.
+	void pop();
+
 	//! Appends a data-string to the (last element of the) buffer
 	//! \note zero-length strings indicate EoF,
 	//! and are stored in a fresh buffer element
 	inline void append(const char *data, size_t count)
-	{
-		if (queue_.empty() || count == 0)
-			queue_.push(string(data, count));
-		else
-			queue_.back().append(data, count);
-	}
-	
+		{ write(data, count, count > 0); }
+
+	//! Moves a data-string to the (last element of the) buffer
+	//! \note Like push, data is left empty; empty strings indicate EoF.
+	inline void append(string &data)
+		{ write(data, !data.empty(), nullptr); }
+
 	//! Removes the first zero-terminated string from the buffer.
-	//! \note Spurious null-characters are also removed.
+	//! \note Spurious null-characters are also removed. The data is not moved
+	//! until the front is accessed, so extracting is linear in the size of
+	//! the string extracted.
 	//! \warning The buffer should not be empty.
 	void extract();
+
+	//! Removes the first message ending in a delimiter from the buffer.
+	//! \param message receives the message, without the delimiter
+	//! \return false if no complete message was received yet.
+	//! \note Empty messages are skipped. When the stream has ended, or the
+	//! element is a packet, the remainder is returned as the final message.
+	//! \warning The delimiter should not be empty.
+	bool extract(const std::string &delimiter, std::string &message);
+
+	//! Returns whether extract would return a message, without removing it
+	//! \note Data already searched is not searched again, by either.
+	//! \warning The delimiter should not be empty.
+	bool complete(const std::string &delimiter);
+
+	//! Describes a piece of stored data
+	struct Chunk
+	{
+		const char *data;
+		size_t size;
+	};
+
+	//! Describes the first elements of the buffer without removing them
+	//! \return the number of chunks stored, at most count.
+	size_t gather(Chunk *chunks, size_t count);
+
+	//! Removes an amount of data from the front of the buffer, elements that
+	//! are used up are removed entirely
+	void consume(size_t size);
+
+	Buffer(const Buffer &) = delete;
+	void operator =(const Buffer &) = delete;
 };
 
 //------------------------------------------------------------------------------
@@ -0,0 +1,984 @@
+/**********************************************************
+ * Socket poller -- See header file for more information. *
+ **********************************************************/
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#ifdef HAVE_EPOLL
+	#include <sys/epoll.h>
+#endif
+
+#ifdef HAVE_IO_URING
+	#include <poll.h>
+	#include <sys/mman.h>
+	#include <sys/syscall.h>
+	#include <linux/io_uring.h>
+#endif
+
+#include "Poller.h"
+
+namespace AGSSockAPI {
+
+//------------------------------------------------------------------------------
+/*
+
+	Three implementations are provided, the first one that works is used:
+
+		1. io_uring (Linux, opt-in at build time)
+			Sockets get a multishot receive that lets the kernel write incoming
+			data into a shared ring of buffers; waiting hands these over
+			without any further system calls. Changes are queued and submitted
+			along with the next wait.
+
+		2. epoll (Linux)
+			Sockets are registered with the kernel once; waiting only returns
+			the ones that are ready regardless of how many are registered.
+			Changes take effect right away, even while another thread waits.
+
+		3. select (portable fallback)
+			The descriptor sets are kept up to date as sockets are added and
+			removed, and copied for every wait; only the sockets found ready
+			are looked up afterwards. Sockets are refused once FD_SETSIZE
+			would be exceeded, as FD_SET does not check this on all platforms.
+
+*/
+
+struct Poller::Data
+{
+	virtual ~Data() {}
+
+	virtual bool add(SOCKET sock, void *user, bool receive) = 0;
+	virtual void remove(SOCKET sock) = 0;
+	virtual void watch(SOCKET sock, void *user, bool read, bool write) = 0;
+	virtual int wait(Event *events, int count, long timeout) = 0;
+	virtual bool deferred() const { return true; }
+	virtual const char *name() const = 0;
+
+	//! Stores a readiness event
+	static void ready(Event &event, void *user, bool read = true,
+		bool write = false)
+	{
+		event.user = user;
+		event.readable = read;
+		event.writable = write;
+		event.received = false;
+		event.data = nullptr;
+		event.size = 0;
+		event.error = 0;
+	}
+};
+
+//==============================================================================
+
+struct SelectData : public Poller::Data
+{
+	struct Entry
+	{
+		void *user;
+		bool read;
+		bool write;
+	};
+
+	Mutex mutex;
+	std::unordered_map<SOCKET, Entry> entries;
+	fd_set reads, writes; //!< Kept up to date as entries change
+	SOCKET highest = 0;   //!< Largest descriptor in the sets (POSIX only)
+	size_t next = 0;      //!< Where to resume reporting, so no socket starves
+
+	SelectData() { FD_ZERO(&reads); FD_ZERO(&writes); }
+
+	bool add(SOCKET sock, void *user, bool receive);
+	void remove(SOCKET sock);
+	void watch(SOCKET sock, void *user, bool read, bool write);
+	int wait(Poller::Event *events, int count, long timeout);
+	const char *name() const { return "select"; }
+
+	void update(SOCKET sock, const Entry &);
+	bool report(Poller::Event &, SOCKET sock, bool readable, bool writable);
+};
+
+//------------------------------------------------------------------------------
+
+//! Brings the sets in line with an entry
+//! \note Call with the mutex locked
+void SelectData::update(SOCKET sock, const Entry &entry)
+{
+	// Note: on Windows FD_SET and FD_CLR search the set, elsewhere they merely
+	//       flip a bit.
+	if (entry.read)
+		FD_SET(sock, &reads);
+	else
+		FD_CLR(sock, &reads);
+
+	if (entry.write)
+		FD_SET(sock, &writes);
+	else
+		FD_CLR(sock, &writes);
+}
+
+//------------------------------------------------------------------------------
+
+bool SelectData::add(SOCKET sock, void *user, bool)
+{
+	Mutex::Lock lock(mutex);
+
+	// Windows limits the number of sockets, elsewhere the descriptor values
+#ifdef _WIN32
+	if (entries.size() >= FD_SETSIZE)
+#else
+	if (sock < 0 || sock >= FD_SETSIZE)
+#endif
+	{
+		SET_ERROR(MFILE);
+		return false;
+	}
+
+	Entry &entry = entries[sock];
+	entry = Entry {user, true, false};
+	update(sock, entry);
+	highest = std::max(highest, sock);
+	return true;
+}
+
+//------------------------------------------------------------------------------
+
+void SelectData::remove(SOCKET sock)
+{
+	Mutex::Lock lock(mutex);
+
+	if (!entries.erase(sock))
+		return;
+
+	FD_CLR(sock, &reads);
+	FD_CLR(sock, &writes);
+
+	// Only the largest descriptor requires looking at the others
+#ifndef _WIN32
+	if (sock == highest)
+	{
+		highest = 0;
+		for (auto &entry : entries)
+			highest = std::max(highest, entry.first);
+	}
+#endif
+}
+
+//------------------------------------------------------------------------------
+
+void SelectData::watch(SOCKET sock, void *, bool read, bool write)
+{
+	Mutex::Lock lock(mutex);
+
+	// Note: this takes effect the next time the caller waits
+	auto it = entries.find(sock);
+	if (it == entries.end())
+		return;
+
+	it->second.read = read;
+	it->second.write = write;
+	update(sock, it->second);
+}
+
+//------------------------------------------------------------------------------
+
+//! Stores an event for a socket select found ready, if it is still wanted
+//! \note Call with the mutex locked
+bool SelectData::report(Poller::Event &event, SOCKET sock, bool readable,
+	bool writable)
+{
+	// Sockets may have been changed or removed while waiting
+	auto it = entries.find(sock);
+	if (it == entries.end())
+		return false;
+
+	readable = readable && it->second.read;
+	writable = writable && it->second.write;
+	if (!readable && !writable)
+		return false;
+
+	ready(event, it->second.user, readable, writable);
+	return true;
+}
+
+//------------------------------------------------------------------------------
+
+int SelectData::wait(Poller::Event *events, int count, long timeout)
+{
+	fd_set read, write;
+	SOCKET nfds;
+
+	// The sets are merely copied, no matter how many sockets there are
+	{
+		Mutex::Lock lock(mutex);
+
+		read = reads;
+		write = writes;
+		nfds = highest + 1; // Ignored by Windows
+	}
+
+	timeval limit = {(long) (timeout / 1000), (long) (timeout % 1000) * 1000};
+	timeval *wait = (timeout < 0 ? nullptr : &limit);
+
+	// If select errs a socket was most likely closed locally, this is fine.
+	// We report all sockets so the caller can check which one(s); it has to
+	// ignore all 'would block's.
+#ifdef _WIN32
+	// Windows reports failed connections as exceptions rather than writable
+	fd_set except = write;
+	bool failed = select(nfds, &read, &write, &except, wait) < 0;
+#else
+	bool failed = select(nfds, &read, &write, nullptr, wait) < 0;
+#endif
+
+	Mutex::Lock lock(mutex);
+
+	int ret = 0;
+	if (failed)
+	{
+		for (auto &entry : entries)
+			if (ret < count)
+				ret += report(events[ret], entry.first, true, true);
+		return ret;
+	}
+
+	// Only the ready sockets are looked at, starting at a different one every
+	// time in case not all fit.
+#ifdef _WIN32
+	// Windows lists the sockets that are ready
+	u_int size = read.fd_count + write.fd_count + except.fd_count;
+	for (u_int i = 0; i < size && ret < count; ++i)
+	{
+		u_int index = (u_int) ((next + i) % size);
+		if (index < read.fd_count)
+			ret += report(events[ret], read.fd_array[index], true, false);
+		else if ((index -= read.fd_count) < write.fd_count)
+			ret += report(events[ret], write.fd_array[index], false, true);
+		else
+			ret += report(events[ret], except.fd_array[index - write.fd_count],
+				false, true);
+	}
+	if (size > 0)
+		next = (next + 1) % size;
+#else
+	// Elsewhere the sets are bit arrays, which are skipped 64 descriptors at
+	// a time where nothing is ready.
+	static_assert(sizeof (fd_set) % sizeof (std::uint64_t) == 0,
+		"fd_set is expected to be a bit array");
+	const char *read_bits = reinterpret_cast<const char *> (&read);
+	const char *write_bits = reinterpret_cast<const char *> (&write);
+
+	size_t blocks = (nfds + 63) / 64;
+	for (size_t i = 0; i < blocks && ret < count; ++i)
+	{
+		size_t block = (next + i) % blocks;
+		std::uint64_t bits[2];
+		memcpy(&bits[0], read_bits + block * sizeof (std::uint64_t), sizeof (std::uint64_t));
+		memcpy(&bits[1], write_bits + block * sizeof (std::uint64_t), sizeof (std::uint64_t));
+		if (!(bits[0] | bits[1]))
+			continue;
+
+		SOCKET end = std::min<SOCKET>(nfds, (block + 1) * 64);
+		for (SOCKET sock = block * 64; sock < end && ret < count; ++sock)
+		{
+			bool readable = FD_ISSET(sock, &read);
+			bool writable = FD_ISSET(sock, &write);
+			if (readable || writable)
+				ret += report(events[ret], sock, readable, writable);
+		}
+	}
+	if (blocks > 0)
+		next = (next + 1) % blocks;
+#endif
+	return ret;
+}
+
+//==============================================================================
+
+#ifdef HAVE_EPOLL
+
+struct EpollData : public Poller::Data
+{
+	int fd;
+
+	EpollData() : fd(epoll_create1(EPOLL_CLOEXEC)) {}
+	~EpollData() { if (fd != -1) close(fd); }
+
+	bool add(SOCKET sock, void *user, bool receive);
+	void remove(SOCKET sock);
+	void watch(SOCKET sock, void *user, bool read, bool write);
+	int wait(Poller::Event *events, int count, long timeout);
+	bool deferred() const { return false; }
+	const char *name() const { return "epoll"; }
+};
+
+//------------------------------------------------------------------------------
+
+bool EpollData::add(SOCKET sock, void *user, bool)
+{
+	epoll_event event;
+	event.events = EPOLLIN;
+	event.data.ptr = user;
+	return !epoll_ctl(fd, EPOLL_CTL_ADD, sock, &event);
+}
+
+//------------------------------------------------------------------------------
+
+void EpollData::remove(SOCKET sock)
+{
+	// Closed sockets are removed automatically, so errors are of no concern
+	epoll_event event = {}; // Required to be non-null before Linux 2.6.9
+	epoll_ctl(fd, EPOLL_CTL_DEL, sock, &event);
+}
+
+//------------------------------------------------------------------------------
+
+void EpollData::watch(SOCKET sock, void *user, bool read, bool write)
+{
+	// Errors and hang-ups are always reported, so a socket that is watched
+	// for nothing is taken out of the set until it is watched again.
+	epoll_event event = {};
+	if (!read && !write)
+	{
+		epoll_ctl(fd, EPOLL_CTL_DEL, sock, &event);
+		return;
+	}
+
+	event.events = (read ? EPOLLIN : 0) | (write ? EPOLLOUT : 0);
+	event.data.ptr = user;
+	if (epoll_ctl(fd, EPOLL_CTL_MOD, sock, &event) && GET_ERROR() == ENOENT)
+		epoll_ctl(fd, EPOLL_CTL_ADD, sock, &event);
+}
+
+//------------------------------------------------------------------------------
+
+int EpollData::wait(Poller::Event *events, int count, long timeout)
+{
+	epoll_event ready[64];
+	int ret = epoll_wait(fd, ready, MIN(count, 64), (int) timeout);
+
+	// An interrupted wait is reported as no sockets being ready
+	if (ret < 0)
+		return 0;
+
+	// Errors and hang-ups are reported as readable; reading reveals them
+	for (int i = 0; i < ret; ++i)
+		Data::ready(events[i], ready[i].data.ptr,
+			ready[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP),
+			ready[i].events & EPOLLOUT);
+	return ret;
+}
+
+#endif /* HAVE_EPOLL */
+
+//==============================================================================
+
+#ifdef HAVE_IO_URING
+
+struct UringData : public Poller::Data
+{
+	// A single group of provided buffers is shared by all sockets
+	static const unsigned BUFFER_COUNT = 32; // Must be a power of two
+	static const unsigned BUFFER_SIZE = 65536;
+	static const unsigned BUFFER_GROUP = 0;
+
+	//! A watched socket, its address is used to identify its requests
+	//! \note Write polls are identified by the address plus one.
+	struct Entry
+	{
+		SOCKET fd;
+		void *user;
+		bool receive;  //!< Multishot receive, otherwise multishot poll
+		bool read;     //!< Whether incoming data should be reported
+		bool armed;    //!< Whether a request is in flight
+		bool removed;  //!< Freed when the requests in flight complete
+		bool write;    //!< Whether being writable should be reported
+		bool polling;  //!< Whether a write poll is in flight
+	};
+
+	int fd;
+	Mutex mutex; //!< Guards the submission queue and the entries
+
+	// Submission queue
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	io_uring_sqe *sqes;
+	unsigned sq_entries;
+	unsigned pending; //!< Number of prepared but unsubmitted requests
+	                  //!< Note: only submitted when waiting or when full
+
+	// Completion queue
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	io_uring_cqe *cqes;
+
+	// Mappings
+	void *sq_ptr, *cq_ptr;
+	size_t sq_size, cq_size, sqes_size;
+
+	// Provided buffers
+	// Note: io_uring_buf_ring is not laid out correctly when compiled as C++,
+	// the ring is addressed as an array instead; its tail overlays the first
+	// entry.
+	// Note: buffers are handed back on the next wait, so the data is copied out
+	// by then; were they kept until the script reads, a single slow reader
+	// would leave the other sockets without any.
+	io_uring_buf *ring;
+	char *buffers;
+	std::vector<unsigned short> used; //!< Buffers handed out by last wait
+
+	std::unordered_map<SOCKET, Entry *> entries;
+	std::unordered_set<Entry *> orphans; //!< Removed, awaiting completions
+	std::vector<Entry *> rearm;   //!< Entries that ran out of buffers
+	std::vector<Entry *> rewrite; //!< Entries that reported being writable
+	__kernel_timespec limit;      //!< Of the last wait, until submitted
+
+	UringData();
+	~UringData();
+
+	bool valid() const { return ring != nullptr; }
+
+	bool add(SOCKET sock, void *user, bool receive);
+	void remove(SOCKET sock);
+	void watch(SOCKET sock, void *user, bool read, bool write);
+	int wait(Poller::Event *events, int count, long timeout);
+	const char *name() const { return "io_uring"; }
+
+	io_uring_sqe *prepare();
+	void arm(Entry *);
+	void poll(Entry *);
+	void cancel(std::uintptr_t user_data);
+	int submit();
+	void recycle(unsigned short bid);
+};
+
+//------------------------------------------------------------------------------
+
+UringData::UringData()
+	: fd(-1), sqes(nullptr), pending(0), sq_ptr(MAP_FAILED), cq_ptr(MAP_FAILED),
+	  sq_size(0), cq_size(0), sqes_size(0), ring(nullptr), buffers(nullptr)
+{
+	io_uring_params params;
+	memset(&params, 0, sizeof (params));
+	params.flags = IORING_SETUP_CQSIZE;
+	params.cq_entries = 1024;
+
+	fd = syscall(__NR_io_uring_setup, 64, &params);
+	if (fd < 0)
+		return;
+
+	// Map the rings
+	sq_size = params.sq_off.array + params.sq_entries * sizeof (unsigned);
+	cq_size = params.cq_off.cqes + params.cq_entries * sizeof (io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if (sq_size < cq_size)
+			sq_size = cq_size;
+		cq_size = sq_size;
+	}
+
+	sq_ptr = mmap(nullptr, sq_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (sq_ptr == MAP_FAILED)
+		return;
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+		cq_ptr = sq_ptr;
+	else
+	{
+		cq_ptr = mmap(nullptr, cq_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if (cq_ptr == MAP_FAILED)
+			return;
+	}
+
+	sqes_size = params.sq_entries * sizeof (io_uring_sqe);
+	void *ptr = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (ptr == MAP_FAILED)
+		return;
+	sqes = static_cast<io_uring_sqe *> (ptr);
+
+	char *sq = static_cast<char *> (sq_ptr);
+	sq_head = reinterpret_cast<unsigned *> (sq + params.sq_off.head);
+	sq_tail = reinterpret_cast<unsigned *> (sq + params.sq_off.tail);
+	sq_mask = reinterpret_cast<unsigned *> (sq + params.sq_off.ring_mask);
+	sq_array = reinterpret_cast<unsigned *> (sq + params.sq_off.array);
+	sq_entries = params.sq_entries;
+
+	char *cq = static_cast<char *> (cq_ptr);
+	cq_head = reinterpret_cast<unsigned *> (cq + params.cq_off.head);
+	cq_tail = reinterpret_cast<unsigned *> (cq + params.cq_off.tail);
+	cq_mask = reinterpret_cast<unsigned *> (cq + params.cq_off.ring_mask);
+	cqes = reinterpret_cast<io_uring_cqe *> (cq + params.cq_off.cqes);
+
+	// Register the provided buffer ring (Linux 5.19)
+	void *mem = nullptr;
+	size_t ring_size = BUFFER_COUNT * sizeof (io_uring_buf);
+	if (posix_memalign(&mem, sysconf(_SC_PAGESIZE), ring_size))
+		return;
+	buffers = static_cast<char *> (malloc(BUFFER_COUNT * BUFFER_SIZE));
+	if (buffers == nullptr)
+	{
+		free(mem);
+		return;
+	}
+	memset(mem, 0, ring_size);
+
+	io_uring_buf_reg reg;
+	memset(&reg, 0, sizeof (reg));
+	reg.ring_addr = reinterpret_cast<std::uintptr_t> (mem);
+	reg.ring_entries = BUFFER_COUNT;
+	reg.bgid = BUFFER_GROUP;
+	if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PBUF_RING,
+		&reg, 1))
+	{
+		free(mem);
+		return;
+	}
+	ring = static_cast<io_uring_buf *> (mem);
+
+	for (unsigned short bid = 0; bid < BUFFER_COUNT; ++bid)
+		recycle(bid);
+}
+
+//------------------------------------------------------------------------------
+
+UringData::~UringData()
+{
+	// Closing the ring cancels all requests in flight
+	if (fd >= 0)
+		close(fd);
+
+	if (sqes != nullptr)
+		munmap(sqes, sqes_size);
+	if (cq_ptr != MAP_FAILED && cq_ptr != sq_ptr)
+		munmap(cq_ptr, cq_size);
+	if (sq_ptr != MAP_FAILED)
+		munmap(sq_ptr, sq_size);
+
+	free(ring);
+	free(buffers);
+
+	for (auto &entry : entries)
+		delete entry.second;
+	for (Entry *entry : orphans)
+		delete entry;
+}
+
+//------------------------------------------------------------------------------
+
+//! Returns a buffer to the kernel
+void UringData::recycle(unsigned short bid)
+{
+	unsigned short tail = ring[0].resv;
+	io_uring_buf &buf = ring[tail & (BUFFER_COUNT - 1)];
+	buf.addr = reinterpret_cast<std::uintptr_t> (buffers + bid * BUFFER_SIZE);
+	buf.len = BUFFER_SIZE;
+	buf.bid = bid;
+	__atomic_store_n(&ring[0].resv, (unsigned short) (tail + 1), __ATOMIC_RELEASE);
+}
+
+//------------------------------------------------------------------------------
+
+//! Returns a fresh submission entry, submitting earlier ones if necessary
+//! \note Call with the mutex locked
+io_uring_sqe *UringData::prepare()
+{
+	unsigned tail = *sq_tail;
+	if (tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries)
+	{
+		submit();
+		tail = *sq_tail;
+	}
+
+	unsigned index = tail & *sq_mask;
+	io_uring_sqe *sqe = &sqes[index];
+	memset(sqe, 0, sizeof (io_uring_sqe));
+	sq_array[index] = index;
+	__atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+	++pending;
+	return sqe;
+}
+
+//------------------------------------------------------------------------------
+
+//! Submits all prepared requests
+//! \note Call with the mutex locked
+int UringData::submit()
+{
+	unsigned count = pending;
+	pending = 0;
+	return syscall(__NR_io_uring_enter, fd, count, 0, 0, nullptr, 0);
+}
+
+//------------------------------------------------------------------------------
+
+//! Starts a multishot request for an entry
+//! \note Call with the mutex locked
+void UringData::arm(Entry *entry)
+{
+	io_uring_sqe *sqe = prepare();
+	sqe->fd = entry->fd;
+	sqe->user_data = reinterpret_cast<std::uintptr_t> (entry);
+
+	if (entry->receive)
+	{
+		sqe->opcode = IORING_OP_RECV;
+		sqe->ioprio = IORING_RECV_MULTISHOT;
+		sqe->flags = IOSQE_BUFFER_SELECT;
+		sqe->buf_group = BUFFER_GROUP;
+	}
+	else
+	{
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->poll32_events = POLLIN;
+		sqe->len = IORING_POLL_ADD_MULTI;
+	}
+	entry->armed = true;
+}
+
+//------------------------------------------------------------------------------
+
+//! Starts a single write poll for an entry
+//! \note Call with the mutex locked
+void UringData::poll(Entry *entry)
+{
+	io_uring_sqe *sqe = prepare();
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = entry->fd;
+	sqe->poll32_events = POLLOUT;
+	sqe->user_data = reinterpret_cast<std::uintptr_t> (entry) + 1;
+	entry->polling = true;
+}
+
+//------------------------------------------------------------------------------
+
+//! Cancels a request in flight
+//! \note Call with the mutex locked
+void UringData::cancel(std::uintptr_t user_data)
+{
+	io_uring_sqe *sqe = prepare();
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = user_data;
+	sqe->user_data = 0;
+}
+
+//------------------------------------------------------------------------------
+
+bool UringData::add(SOCKET sock, void *user, bool receive)
+{
+	Mutex::Lock lock(mutex);
+
+	// Note: failures are reported when the request completes
+	Entry *entry = new Entry {sock, user, receive, true, false, false, false,
+		false};
+	entries[sock] = entry;
+	arm(entry);
+	return true;
+}
+
+//------------------------------------------------------------------------------
+
+void UringData::remove(SOCKET sock)
+{
+	Mutex::Lock lock(mutex);
+
+	auto it = entries.find(sock);
+	if (it == entries.end())
+		return;
+
+	Entry *entry = it->second;
+	entries.erase(it);
+	entry->removed = true;
+
+	for (std::vector<Entry *> *list : {&rearm, &rewrite})
+		for (size_t i = 0; i < list->size(); ++i)
+			if ((*list)[i] == entry)
+				list->erase(list->begin() + i--);
+
+	if (!entry->armed && !entry->polling)
+	{
+		delete entry;
+		return;
+	}
+
+	// The entry is freed when the cancelled requests complete
+	orphans.insert(entry);
+	std::uintptr_t user_data = reinterpret_cast<std::uintptr_t> (entry);
+	if (entry->armed)
+		cancel(user_data);
+	if (entry->polling)
+		cancel(user_data + 1);
+}
+
+//------------------------------------------------------------------------------
+
+void UringData::watch(SOCKET sock, void *, bool read, bool write)
+{
+	Mutex::Lock lock(mutex);
+
+	auto it = entries.find(sock);
+	if (it == entries.end())
+		return;
+
+	// Reading stops by cancelling the multishot request; should reading
+	// resume before the cancellation completes, it is restarted then.
+	Entry *entry = it->second;
+	if (entry->read != read)
+	{
+		entry->read = read;
+		if (!read && entry->armed)
+			cancel(reinterpret_cast<std::uintptr_t> (entry));
+		else if (read && !entry->armed)
+			arm(entry);
+	}
+
+	// A poll in flight is left alone, its outcome is ignored if unwanted
+	entry->write = write;
+	if (write && !entry->polling)
+		poll(entry);
+}
+
+//------------------------------------------------------------------------------
+
+int UringData::wait(Poller::Event *events, int count, long timeout)
+{
+	Mutex::Lock lock(mutex);
+
+	// The data handed out by the last call is no longer in use
+	for (unsigned short bid : used)
+		recycle(bid);
+	used.clear();
+
+	for (Entry *entry : rearm)
+		if (entry->read && !entry->armed)
+			arm(entry);
+	rearm.clear();
+
+	for (Entry *entry : rewrite)
+		if (entry->write && !entry->polling)
+			poll(entry);
+	rewrite.clear();
+
+	unsigned head = *cq_head;
+	if (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+	{
+		// The wait is limited by a timeout request, which completes as
+		// ignored; it is copied by the kernel when submitted.
+		if (timeout >= 0)
+		{
+			limit.tv_sec = timeout / 1000;
+			limit.tv_nsec = (timeout % 1000) * 1000000;
+			io_uring_sqe *sqe = prepare();
+			sqe->opcode = IORING_OP_TIMEOUT;
+			sqe->fd = -1;
+			sqe->addr = reinterpret_cast<std::uintptr_t> (&limit);
+			sqe->len = 1;
+			sqe->user_data = 0;
+		}
+
+		// Nothing completed yet: submit all changes and wait in a single
+		// call, without blocking others
+		unsigned submitted = pending;
+		pending = 0;
+		mutex.unlock();
+		int ret = syscall(__NR_io_uring_enter, fd, submitted, 1,
+			IORING_ENTER_GETEVENTS, nullptr, 0);
+		mutex.lock();
+		if (ret < 0)
+		{
+			// Nothing was submitted, the requests are still queued
+			pending += submitted;
+			return 0;
+		}
+	}
+	else if (pending)
+		submit();
+
+	int ret = 0;
+	unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+	for (; head != tail && ret < count; ++head)
+	{
+		io_uring_cqe &cqe = cqes[head & *cq_mask];
+		bool write = cqe.user_data & 1;
+		Entry *entry = reinterpret_cast<Entry *> (cqe.user_data & ~std::uintptr_t(1));
+		bool more = cqe.flags & IORING_CQE_F_MORE;
+		bool buffer = cqe.flags & IORING_CQE_F_BUFFER;
+		unsigned short bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+
+		if (buffer)
+			used.push_back(bid);
+
+		if (entry == nullptr) // Cancel requests
+			continue;
+
+		if (write)
+			entry->polling = false;
+		else if (!more)
+			entry->armed = false;
+
+		if (entry->removed)
+		{
+			if (!entry->armed && !entry->polling)
+			{
+				orphans.erase(entry);
+				delete entry;
+			}
+			continue;
+		}
+
+		if (write)
+		{
+			// Polled again on the next wait if still wanted by then
+			if (entry->write)
+			{
+				ready(events[ret++], entry->user, false, true);
+				rewrite.push_back(entry);
+			}
+			continue;
+		}
+
+		if (cqe.res == -ECANCELED)
+		{
+			// Reading was stopped, but it may have been resumed since
+			if (!entry->armed && entry->read)
+				arm(entry);
+			continue;
+		}
+
+		if (!entry->receive)
+		{
+			// On errors the caller will find out what is wrong when reading
+			ready(events[ret++], entry->user);
+			if (!more && cqe.res >= 0 && entry->read)
+				arm(entry);
+			continue;
+		}
+
+		if (cqe.res == -ENOBUFS)
+		{
+			// Data is waiting, retry when buffers have been recycled
+			rearm.push_back(entry);
+			continue;
+		}
+
+		if (cqe.res == -EINVAL || cqe.res == -ENOTSOCK
+			|| cqe.res == -EOPNOTSUPP)
+		{
+			// Multishot receive is unsupported (Linux 6.0), use poll instead
+			entry->receive = false;
+			if (entry->read)
+				arm(entry);
+			continue;
+		}
+
+		Poller::Event &event = events[ret++];
+		event.user = entry->user;
+		event.readable = true;
+		event.writable = false;
+		event.received = true;
+		event.data = buffer ? buffers + bid * BUFFER_SIZE : nullptr;
+		event.size = cqe.res < 0 ? SOCKET_ERROR : cqe.res;
+		event.error = cqe.res < 0 ? -cqe.res : 0;
+
+		// The request ends by itself on errors and end of stream; otherwise
+		// it has to be restarted.
+		if (!more && cqe.res > 0 && entry->read)
+			arm(entry);
+	}
+	__atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+
+	if (pending)
+		submit();
+	return ret;
+}
+
+#endif /* HAVE_IO_URING */
+
+//==============================================================================
+
+Poller::Poller() : data(nullptr)
+{
+#ifdef HAVE_IO_URING
+	UringData *uring = new UringData();
+	if (uring->valid())
+	{
+		data = uring;
+		return;
+	}
+	delete uring;
+#endif
+#ifdef HAVE_EPOLL
+	EpollData *epoll = new EpollData();
+	if (epoll->fd != -1)
+	{
+		data = epoll;
+		return;
+	}
+	delete epoll;
+#endif
+	data = new SelectData();
+}
+
+//------------------------------------------------------------------------------
+
+Poller::~Poller()
+{
+	delete data;
+	data = nullptr;
+}
+
+//------------------------------------------------------------------------------
+
+bool Poller::add(SOCKET sock, void *user, bool receive)
+{
+	return data->add(sock, user, receive);
+}
+
+//------------------------------------------------------------------------------
+
+void Poller::remove(SOCKET sock)
+{
+	data->remove(sock);
+}
+
+//------------------------------------------------------------------------------
+
+void Poller::watch(SOCKET sock, void *user, bool read, bool write)
+{
+	data->watch(sock, user, read, write);
+}
+
+//------------------------------------------------------------------------------
+
+int Poller::wait(Event *events, int count, long timeout)
+{
+	return data->wait(events, count, timeout);
+}
+
+//------------------------------------------------------------------------------
+
+bool Poller::deferred() const
+{
+	return data->deferred();
+}
+
+//------------------------------------------------------------------------------
+
+const char *Poller::backend() const
+{
+	return data->name();
+}
+
+//------------------------------------------------------------------------------
+
+} /* namespace AGSSockAPI */
+
+//..............................................................................
@@ -0,0 +1,89 @@
+/*******************************************************
+ * Socket poller -- header file                        *
+ *                                                     *
+ * Author: agent                                       *
+ *                                                     *
+ * Date: 10:12 2026-10-18                              *
+ *                                                     *
+ * Description: Reports which sockets are ready for    *
+ *              reading or writing using the best      *
+ *              mechanism the platform has to offer.   *
+ *******************************************************/
+
+#ifndef _POLLER_H
+#define _POLLER_H
+
+#include "API.h"
+
+namespace AGSSockAPI {
+
+//------------------------------------------------------------------------------
+
+//! Socket readiness notification class
+
+//! Sockets are registered once and only the ones that became ready are
+//! reported back. The backend is chosen when the poller is created: io_uring
+//! (when compiled in and supported by the kernel), epoll or select.
+//! \note Adding and removing sockets is allowed while another thread waits.
+class Poller
+{
+	public:
+	//! Describes a socket that became ready
+	struct Event
+	{
+		void *user;       //!< The value the socket was registered with
+		bool readable;    //!< Whether the socket has data or an error
+		bool writable;    //!< Whether the socket can be written to
+		bool received;    //!< Whether the poller already read the socket
+		const char *data; //!< The data read on behalf of the socket
+		long size;        //!< The amount of data read or SOCKET_ERROR
+		int error;        //!< The error code in case of SOCKET_ERROR
+	};
+
+	Poller();
+	~Poller();
+
+	//! Starts watching a socket for incoming data
+
+	//! When receive is set the poller may read the incoming data itself and
+	//! hand it over with the event, as if recv was called. This is only done
+	//! by backends where this is cheaper; others just report readiness.
+	//! \return false on failure, the error code is set accordingly.
+	bool add(SOCKET sock, void *user, bool receive = false);
+	//! Stops watching a previously added socket
+	void remove(SOCKET sock);
+	//! Sets whether a previously added socket is watched for incoming data
+	//! and for being writable; user should be the value it was added with.
+	//! \note Data the poller received before reading stopped is still
+	//! reported.
+	void watch(SOCKET sock, void *user, bool read, bool write);
+	//! Waits until at least one socket is ready and returns how many ready
+	//! sockets were stored in the events array (at most count).
+	//! \param timeout in milliseconds after which none are returned,
+	//! negative to wait indefinitely
+	//! \note Received data remains valid until the next call.
+	int wait(Event *events, int count, long timeout = -1);
+
+	//! Returns whether changes only take effect once a waiting thread wakes
+	//! up; they are then applied in a single batch.
+	bool deferred() const;
+
+	//! Returns the name of the backend in use
+	const char *backend() const;
+
+	Poller(const Poller &) = delete;
+	void operator =(const Poller &) = delete;
+
+	struct Data; //!< Backend interface
+
+	private:
+	Data *data;
+};
+
+//------------------------------------------------------------------------------
+
+} /* namespace AGSSockAPI */
+
+#endif /* _POLLER_H */
+
+//..............................................................................
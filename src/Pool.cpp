@@ -9,107 +9,159 @@
 	#define DEBUG_P(x) std::puts("\t\t" x)
 #endif
 
+#include <algorithm>
+
+#ifndef _WIN32
+	#include <sys/uio.h>
+#endif
+
 #include "Pool.h"
+#include "Resolver.h"
+
+// Writing to a socket the peer closed should not raise SIGPIPE
+#ifndef MSG_NOSIGNAL
+	#define MSG_NOSIGNAL 0
+#endif
 
 namespace AGSSock {
 
 using namespace AGSSockAPI;
 
-// Invariant I: (sockets_.size() > 0) => thread_->active()
+// Invariant I: (sockets_.size() > 0 || persistent_) => thread_->active()
 // Invariant II: (sock->id == INVALID_SOCKET) => !sockets_.count(sock)
+// Invariant III: paused_.count(sock) => sockets_.count(sock)
+// Invariant IV: lingering_.count(sock) => sockets_.count(sock)
+
+// Returns the milliseconds until a moment, rounded up or the moment would not
+// have come when woken up
+inline long remaining(std::chrono::steady_clock::time_point due,
+	std::chrono::steady_clock::time_point now)
+{
+	using namespace std::chrono;
+	long wait = (long) ((duration_cast<microseconds>(due - now).count() + 999)
+		/ 1000);
+	return std::max(wait, 0L);
+}
+
+// Returns the shortest of two timeouts, where -1 is none
+inline long soonest(long a, long b)
+{
+	return (a < 0 ? b : (b < 0 ? a : std::min(a, b)));
+}
+
+//------------------------------------------------------------------------------
+
+std::atomic<size_t> Pool::unread(0);
+std::atomic<size_t> Pool::unread_limit(0);
+std::atomic<size_t> Pool::paused(0);
+Beacon *Pool::arrivals = nullptr;
+
+//------------------------------------------------------------------------------
+
+Pool::Pool(bool persistent)
+	: held_(0), persistent_(persistent), stopping_(false),
+	thread_([this]() { run(); })
+{
+	// The beacon is registered with a null pointer as it is no pool socket
+	poller_.add(beacon_, nullptr);
+
+	// An idle thread simply waits for the beacon
+	if (persistent_)
+		thread_.start();
+}
+
+Pool::~Pool()
+{
+	Mutex::Lock lock(guard_);
+
+	for (auto &entry : races_)
+		abandon(entry.second);
+	races_.clear();
+	while (!lingering_.empty())
+		bury(lingering_.begin()->first);
+	stopping_ = true;
+	beacon_.signal();
+
+	// The thread is waited for when the members are destroyed
+}
 
 //------------------------------------------------------------------------------
 
 void Pool::run()
 {
-	SOCKET signal = beacon_;
-	fd_set read;
-	int nfds;
+	Poller::Event events[64];
+	long timeout = -1;
 	
 	DEBUG_P("Thread started");
 	for (;;) { /* event loop */
 	
-	// Reset FD sets
-	FD_ZERO(&read);
-	FD_SET(signal, &read);
-	nfds = signal;
-	
-	// Add pool sockets to FD sets
-	{
-		Mutex::Lock lock(guard_);
-		
-		for (Socket *sock : sockets_)
-		{
-			FD_SET(sock->id, &read);
-			// Windows ignores the nfds parameter, skip for efficiency
-		#ifndef _WIN32
-			if (nfds < sock->id)
-				nfds = sock->id;
-		#endif
-		}
-	}
-	
-	// Wait for events
-	select(nfds + 1, &read, nullptr, nullptr, nullptr);
-	// If select errs a socket was most likely closed locally, this is fine.
-	// We need to check which one(s) and ignore all 'would block's.
+	// Wait for events, or until the next connection attempt is due or a
+	// lingering connection is given up on
+	int count = poller_.wait(events, sizeof (events) / sizeof (Poller::Event),
+		timeout);
 	
-	// Process read and error events
+	// Process write, read and error events
 	{
 		Mutex::Lock lock(guard_);
 		
-		if (FD_ISSET(signal, &read))
-		{
-			beacon_.reset();
-			signal = beacon_;
-			DEBUG_P("Thread signalled");
-		}
-
-		for (Sockets::iterator it = sockets_.begin(); it != sockets_.end();)
+		for (int i = 0; i < count; ++i)
 		{
-			Socket *sock = *it;
-
-			if (FD_ISSET(sock->id, &read))
+			Socket *sock = static_cast<Socket *> (events[i].user);
+			
+			if (sock == nullptr)
 			{
-				char buffer[65536];
-				int ret = recv(sock->id, buffer, sizeof (buffer), 0);
-				int error = GET_ERROR();
-				
-				// We ignore sockets that would block:
-				// This is normally filtered by select but a signal could have
-				// interrupted select.
-				if (ret == SOCKET_ERROR && WOULD_BLOCK(error))
+				// The beacon might present a different socket after a reset
+				SOCKET beacon = beacon_;
+				beacon_.reset();
+				if ((SOCKET) beacon_ != beacon)
 				{
-					++it;
-					continue;
+					poller_.remove(beacon);
+					poller_.add(beacon_, nullptr);
 				}
-				
-				// If ret == 0 then closed gracefully (for TCP)
-				// If ret == SOCKET_ERROR probably closed not so gracefully
-				
-				if (ret == SOCKET_ERROR)
-					sock->incoming.error = error;
-				else if (sock->type == SOCK_STREAM)
-					sock->incoming.append(buffer, ret);
-				else
-					sock->incoming.push(buffer, ret);
-				
-				if ((ret == SOCKET_ERROR)
-					|| (!ret && sock->type == SOCK_STREAM))
+				DEBUG_P("Thread signalled");
+			}
+			// Connection attempts are registered with their racing socket
+			else if (races_.count(sock))
+				contend(sock);
+			// Sockets may have been removed while waiting
+			else if (!sockets_.count(sock))
+				continue;
+			else
+			{
+				if (events[i].writable)
 				{
-					// This socket is done for, stop reading
-					sockets_.erase(it++);
+					if (sock->connection == Socket::CONNECTING)
+						connected(sock);
+					if (sockets_.count(sock))
+						write(sock);
+				}
+
+				// Writing may have failed and removed the socket
+				if (!sockets_.count(sock))
 					continue;
-				}	
+				else if (events[i].received)
+					deliver(sock, events[i].data, events[i].size, events[i].error);
+				else if (events[i].readable && !paused_.count(sock))
+					read(sock);
 			}
-
-			++it;
+		}
+		
+		// Races move on as attempts become due and hosts are found, and
+		// lingering connections are given up on once they had their time
+		timeout = soonest(races_.empty() ? -1 : pace(),
+			lingering_.empty() ? -1 : expire());
+		
+		// The thread is not marked inactive so the pool waits for it
+		if (stopping_)
+		{
+			DEBUG_P("Thread stopped");
+			return;
 		}
 		
 		// Close thread if there are no sockets to process anymore
 		// Note: This is safe because the thread will be (re)started when
 		//       sockets are added to the pool which requires the pool lock.
-		if (sockets_.empty())
+		if (sockets_.empty() && races_.empty() && !persistent_)
 		{
 			DEBUG_P("Thread finished");
 			thread_.exit();
@@ -119,10 +171,6 @@ void Pool::run()
 	
 	} /* event loop */
 	
-	// Note: chaining the two critical sections might be more efficient as it
-	// merges the loops, but this is not worth the hassle and might introduce
-	// errors.
-	
 	DEBUG_P("Thread cancelled");
 	thread_.exit();
 	return;
@@ -130,40 +178,792 @@ void Pool::run()
 
 //------------------------------------------------------------------------------
 
-void Pool::add(Socket *sock)
+void Pool::read(Socket *sock)
+{
+	if (sock->type != SOCK_STREAM)
+	{
+		read_batch(sock);
+		return;
+	}
+	
+	// Data is received straight into a string the buffer can take over
+	// Note: only the part that is read into is touched, so sockets that
+	//       receive little do not churn through a large buffer.
+	chunk_.resize(adapt(sock, 0));
+	long ret = recv(sock->id, &chunk_[0], chunk_.size(), 0);
+	int error = GET_ERROR();
+	
+	// We ignore sockets that would block:
+	// This is normally filtered by the poller but a signal could have
+	// interrupted it.
+	if (ret == SOCKET_ERROR && WOULD_BLOCK(error))
+		return;
+	
+	adapt(sock, ret);
+	deliver(sock, chunk_, ret, error);
+}
+
+//------------------------------------------------------------------------------
+
+void Pool::contend(Socket *sock)
+{
+	Race &race = races_[sock];
+	if (race.done)
+		return;
+	
+	for (size_t i = 0; i < race.attempts.size(); )
+	{
+		SOCKET id = race.attempts[i];
+		int error = 0;
+		ADDRLEN length = sizeof (error);
+		if (getsockopt(id, SOL_SOCKET, SO_ERROR,
+			reinterpret_cast<char *> (&error), &length))
+			error = GET_ERROR();
+		
+		// The first connection made wins; attempts in progress have no peer
+		SOCKADDR_STORAGE peer;
+		ADDRLEN addrlen = sizeof (peer);
+		if (!error && !getpeername(id, ADDR(&peer), &addrlen))
+		{
+			race.attempts.erase(race.attempts.begin() + i);
+			race.family = peer.ss_family;
+			settle(sock, race, id);
+			return;
+		}
+		if (!error)
+		{
+			++i;
+			continue;
+		}
+		
+		// A failed attempt makes way for the next address right away
+		poller_.remove(id);
+		closesocket(id);
+		race.attempts.erase(race.attempts.begin() + i);
+		race.error = error;
+		race.due = Clock::now();
+	}
+}
+
+//------------------------------------------------------------------------------
+
+// Alternates the address families, starting with the one preferred
+inline void interleave(std::vector<SOCKADDR_STORAGE> &addrs)
+{
+	std::vector<SOCKADDR_STORAGE> preferred, other;
+	for (const SOCKADDR_STORAGE &addr : addrs)
+		(addr.ss_family == addrs.front().ss_family ? preferred : other)
+			.push_back(addr);
+	
+	addrs.clear();
+	for (size_t i = 0; i < std::max(preferred.size(), other.size()); ++i)
+	{
+		if (i < preferred.size())
+			addrs.push_back(preferred[i]);
+		if (i < other.size())
+			addrs.push_back(other[i]);
+	}
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+long Pool::pace()
+{
+	using namespace std::chrono;
+	
+	auto now = Clock::now();
+	long timeout = -1;
+	
+	for (auto &entry : races_)
+	{
+		Socket *sock = entry.first;
+		Race &race = entry.second;
+		if (race.done)
+			continue;
+		
+		// The host is looked up first, the beacon tells when it is found
+		// Note: the beacon is handed over once, the resolver keeps it.
+		if (race.addrs.empty())
+		{
+			Resolver::Status status = Resolver::request(race.node,
+				race.service, AF_UNSPEC, race.addrs,
+				race.requested ? nullptr : &beacon_);
+			race.requested = true;
+			if (status == Resolver::PENDING)
+				continue;
+			if (status == Resolver::FAILED || race.addrs.empty())
+			{
+				SET_ERROR(HOSTUNREACH);
+				race.error = GET_ERROR();
+				settle(sock, race, INVALID_SOCKET);
+				continue;
+			}
+			interleave(race.addrs);
+		}
+		
+		// The next address is tried once the others had their time, or
+		// right away if they all failed
+		while (!race.done && race.next < race.addrs.size()
+			&& (race.attempts.empty() || now >= race.due))
+		{
+			const SOCKADDR_STORAGE &addr = race.addrs[race.next++];
+			SOCKET id = socket(addr.ss_family, SOCK_STREAM, IPPROTO_TCP);
+			if (id == INVALID_SOCKET)
+			{
+				race.error = GET_ERROR();
+				continue;
+			}
+			
+			setblocking(id, false);
+			if (connect(id, CONST_ADDR(&addr), ADDR_SIZE(&addr)) != SOCKET_ERROR)
+			{
+				race.family = addr.ss_family;
+				settle(sock, race, id);
+				break;
+			}
+			
+			// Attempts report errors either way, being readable or writable
+			int error = GET_ERROR();
+			if (!ALREADY(error) || !poller_.add(id, sock))
+			{
+				race.error = (ALREADY(error) ? GET_ERROR() : error);
+				closesocket(id);
+				continue;
+			}
+			poller_.watch(id, sock, true, true);
+			race.attempts.push_back(id);
+			race.due = now + milliseconds(CONNECT_DELAY);
+		}
+		
+		if (race.done)
+			continue;
+		if (race.attempts.empty())
+		{
+			settle(sock, race, INVALID_SOCKET);
+			continue;
+		}
+		
+		if (race.next < race.addrs.size())
+			timeout = soonest(timeout, remaining(race.due, now));
+	}
+	
+	return timeout;
+}
+
+//------------------------------------------------------------------------------
+
+void Pool::settle(Socket *sock, Race &race, SOCKET winner)
+{
+	abandon(race);
+	if (winner != INVALID_SOCKET)
+		poller_.remove(winner);
+	
+	race.winner = winner;
+	race.done = true;
+	sock->finished = true;
+	if (arrivals != nullptr)
+		arrivals->signal();
+}
+
+void Pool::abandon(Race &race)
+{
+	for (SOCKET id : race.attempts)
+	{
+		poller_.remove(id);
+		closesocket(id);
+	}
+	race.attempts.clear();
+	
+	if (race.winner != INVALID_SOCKET)
+		closesocket(race.winner);
+	race.winner = INVALID_SOCKET;
+}
+
+//------------------------------------------------------------------------------
+
+long Pool::expire()
+{
+	auto now = Clock::now();
+	long timeout = -1;
+	
+	for (auto it = lingering_.begin(); it != lingering_.end(); )
+	{
+		Socket *husk = it->first;
+		Clock::time_point deadline = it->second;
+		++it;
+		
+		if (now >= deadline)
+			bury(husk);
+		else
+			timeout = soonest(timeout, remaining(deadline, now));
+	}
+	
+	return timeout;
+}
+
+void Pool::bury(Socket *husk)
+{
+	poller_.remove(husk->id);
+	sockets_.erase(husk);
+	closing_.erase(husk);
+	lingering_.erase(husk);
+	closesocket(husk->id);
+	delete husk;
+}
+
+//------------------------------------------------------------------------------
+
+size_t Pool::adapt(Socket *sock, long ret)
+{
+	// The bounds may have been changed by the owner meanwhile
+	size_t size = sock->read_size;
+	size_t minimum = sock->read_minimum, maximum = sock->read_maximum;
+	
+	// Reads that fill the buffer suggest more is waiting, so the next read
+	// takes twice as much; reads that barely use it halve it again.
+	if (ret > 0 && (size_t) ret == size)
+		size *= 2;
+	else if (ret > 0 && (size_t) ret < size / 4)
+		size /= 2;
+	
+	sock->read_size = std::min(std::max(size, minimum), maximum);
+	return sock->read_size;
+}
+
+//------------------------------------------------------------------------------
+
+void Pool::read_batch(Socket *sock)
+{
+#ifdef HAVE_RECVMMSG
+	// Note: the memory is not touched beyond what small datagrams fill, so
+	//       only a fraction of it is actually committed.
+	if (!batch_)
+		batch_.reset(new char[BATCH * DATAGRAM]);
+	
+	// A burst of datagrams is read with a single system call
+	// Note: some pollers only report new arrivals, so we read until the
+	//       socket is drained.
+	SOCKADDR_STORAGE sources[BATCH];
+	iovec buffers[BATCH];
+	mmsghdr msgs[BATCH];
+	long ret;
+	do
+	{
+		for (int i = 0; i < BATCH; ++i)
+		{
+			buffers[i].iov_base = batch_.get() + i * DATAGRAM;
+			buffers[i].iov_len = DATAGRAM;
+			msgs[i].msg_hdr = {};
+			msgs[i].msg_hdr.msg_name = &sources[i];
+			msgs[i].msg_hdr.msg_namelen = sizeof (SOCKADDR_STORAGE);
+			msgs[i].msg_hdr.msg_iov = &buffers[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+		
+		ret = recvmmsg(sock->id, msgs, BATCH, 0, nullptr);
+		int error = GET_ERROR();
+		
+		// See read() for sockets that would block
+		if (ret == SOCKET_ERROR)
+		{
+			if (!WOULD_BLOCK(error))
+				deliver(sock, nullptr, ret, error);
+			return;
+		}
+		
+		for (long i = 0; i < ret; ++i)
+			deliver(sock, batch_.get() + i * DATAGRAM, msgs[i].msg_len, 0,
+				&sources[i]);
+	}
+	while (ret == BATCH);
+#else
+	// One datagram at a time where batches are not supported
+	// Note: datagrams that do not fit are cut off, so these are read whole.
+	SOCKADDR_STORAGE source;
+	ADDRLEN addrlen = sizeof (source);
+	chunk_.resize(DATAGRAM);
+	long ret = recvfrom(sock->id, &chunk_[0], chunk_.size(), 0, ADDR(&source),
+		&addrlen);
+	int error = GET_ERROR();
+	
+	// See read() for sockets that would block
+	if (ret == SOCKET_ERROR && WOULD_BLOCK(error))
+		return;
+	
+	deliver(sock, chunk_, ret, error, &source);
+#endif
+}
+
+//------------------------------------------------------------------------------
+
+void Pool::write(Socket *sock)
+{
+	Buffer::Chunk chunks[64];
+	size_t count = sock->outgoing.gather(chunks, sizeof (chunks) / sizeof (Buffer::Chunk));
+	long ret = 0;
+	
+	// Queued sends are gathered into a single system call
+	if (count > 0)
+	{
+#ifdef _WIN32
+		WSABUF buffers[64];
+		for (size_t i = 0; i < count; ++i)
+		{
+			buffers[i].buf = const_cast<char *> (chunks[i].data);
+			buffers[i].len = (ULONG) chunks[i].size;
+		}
+		DWORD sent;
+		if (WSASend(sock->id, buffers, (DWORD) count, &sent, 0, nullptr, nullptr))
+			ret = SOCKET_ERROR;
+		else
+			ret = sent;
+#else
+		iovec buffers[64];
+		for (size_t i = 0; i < count; ++i)
+		{
+			buffers[i].iov_base = const_cast<char *> (chunks[i].data);
+			buffers[i].iov_len = chunks[i].size;
+		}
+		msghdr msg = {};
+		msg.msg_iov = buffers;
+		msg.msg_iovlen = count;
+		ret = sendmsg(sock->id, &msg, MSG_NOSIGNAL);
+#endif
+	}
+	int error = GET_ERROR();
+	
+	if (ret == SOCKET_ERROR)
+	{
+		// Spurious wake-up, the socket is watched still
+		if (WOULD_BLOCK(error))
+			return;
+		
+		// The connection is broken, the owner learns about it when sending
+		sock->outgoing.error = error;
+		drop(sock);
+	}
+	else
+	{
+		sock->outgoing.consume(ret);
+		sock->unsent -= ret;
+	}
+	
+	if (sock->unsent == 0)
+	{
+		poller_.watch(sock->id, sock, !paused_.count(sock), false);
+		if (closing_.erase(sock))
+			::shutdown(sock->id, SD_SEND);
+	}
+}
+
+//------------------------------------------------------------------------------
+
+void Pool::connected(Socket *sock)
+{
+	// The outcome of a connection is only known by asking the socket
+	int error = 0;
+	ADDRLEN length = sizeof (error);
+	if (getsockopt(sock->id, SOL_SOCKET, SO_ERROR,
+		reinterpret_cast<char *> (&error), &length))
+		error = GET_ERROR();
+	
+	if (error)
+	{
+		deliver(sock, nullptr, SOCKET_ERROR, error);
+		return;
+	}
+	
+	sock->connection = Socket::CONNECTED;
+	sock->finished = true;
+	if (arrivals != nullptr)
+		arrivals->signal();
+}
+
+//------------------------------------------------------------------------------
+
+void Pool::drop(Socket *sock)
+{
+	// Note: the owner may be adding data meanwhile, which is then counted
+	//       before it is queued.
+	while (!sock->outgoing.empty())
+	{
+		size_t size = sock->outgoing.front().size();
+		sock->outgoing.pop();
+		sock->unsent -= size;
+	}
+}
+
+//------------------------------------------------------------------------------
+
+bool Pool::full(Socket *sock)
+{
+	size_t limit = sock->receive_limit, total = unread_limit;
+	return (limit && sock->incoming.size() >= limit)
+		|| (total && unread >= total);
+}
+
+//------------------------------------------------------------------------------
+
+bool Pool::admit(Socket *sock, size_t amount)
+{
+	// Datagrams that do not fit are dropped, as the system would have done
+	if (sock->type != SOCK_STREAM && full(sock))
+	{
+		++sock->dropped;
+		return false;
+	}
+	
+	// Counted first so the script never reads more data than is counted
+	unread += amount;
+	return true;
+}
+
+//------------------------------------------------------------------------------
+
+void Pool::throttle(Socket *sock)
+{
+	// Note: a socket that is done for is not touched, its owner may have
+	//       disposed of it as soon as the end of the stream was stored.
+	if (!sockets_.count(sock) || sock->type != SOCK_STREAM
+		|| paused_.count(sock) || !full(sock))
+		return;
+	
+	// The data is left to the system, whose buffer fills up in turn; flow
+	// control then holds the sender back. Outgoing data is still sent.
+	paused_.insert(sock);
+	++held_;
+	++paused;
+	poller_.watch(sock->id, sock, false, sock->unsent > 0);
+}
+
+void Pool::unpause(Socket *sock)
+{
+	if (!paused_.erase(sock))
+		return;
+	
+	--held_;
+	--paused;
+}
+
+//------------------------------------------------------------------------------
+
+void Pool::deliver(Socket *sock, const char *data, long ret, int error,
+	const SOCKADDR_STORAGE *source)
+{
+	// If ret == 0 then closed gracefully (for TCP)
+	// If ret == SOCKET_ERROR probably closed not so gracefully
+	
+	// Nobody reads a lingering connection, it only waits to be closed
+	if (lingering_.count(sock))
+	{
+		if (ret == SOCKET_ERROR || !ret)
+			bury(sock);
+		return;
+	}
+	
+	if ((ret == SOCKET_ERROR)
+		|| (!ret && sock->type == SOCK_STREAM))
+	{
+		// This socket is done for, stop reading
+		// Note: this is done first as the socket may be closed as soon as its
+		//       owner learns about it.
+		poller_.remove(sock->id);
+		sockets_.erase(sock);
+		closing_.erase(sock);
+		unpause(sock);
+		
+		// Data queued while connecting will never be sent
+		if (sock->connection == Socket::CONNECTING)
+		{
+			sock->outgoing.error = error;
+			drop(sock);
+			sock->connection = Socket::FAILED;
+			sock->finished = true;
+		}
+		else
+			sock->connection = Socket::UNCONNECTED;
+	}
+	
+	if (ret == SOCKET_ERROR)
+		sock->incoming.error = error;
+	else if (!admit(sock, ret))
+		return;
+	else if (sock->type == SOCK_STREAM)
+		sock->incoming.append(data, ret);
+	else
+		sock->incoming.push(data, ret, source);
+	
+	throttle(sock);
+	if (arrivals != nullptr)
+		arrivals->signal();
+}
+
+//------------------------------------------------------------------------------
+
+void Pool::deliver(Socket *sock, Bytes &data, long ret, int error,
+	const SOCKADDR_STORAGE *source)
+{
+	// Small amounts are copied so the string keeps its storage for reuse;
+	// its size is then only a fraction of its capacity.
+	if (ret < HANDOFF || lingering_.count(sock))
+	{
+		deliver(sock, data.data(), ret, error, source);
+		return;
+	}
+	
+	// Large amounts are handed over to the buffer without copying, which in
+	// turn hands them to the script as is when received as data.
+	data.resize(ret);
+	if (!admit(sock, ret))
+		return;
+	if (sock->type == SOCK_STREAM)
+		sock->incoming.append(data);
+	else
+		sock->incoming.push(data, source);
+	
+	throttle(sock);
+	if (arrivals != nullptr)
+		arrivals->signal();
+}
+
+//------------------------------------------------------------------------------
+
+bool Pool::add(Socket *sock)
 {
 	Mutex::Lock lock(guard_);
 
-	if (sockets_.insert(sock).second && sockets_.size() == 1)
-		thread_.start();
+	if (sockets_.count(sock))
+	{
+		// Re-adding a socket revalidates it; this fails for closed sockets
+		int type;
+		ADDRLEN length = sizeof (type);
+		if (getsockopt(sock->id, SOL_SOCKET, SO_TYPE,
+			reinterpret_cast<char *> (&type), &length))
+		{
+			int error = GET_ERROR();
+			poller_.remove(sock->id);
+			sockets_.erase(sock);
+			closing_.erase(sock);
+			unpause(sock);
+			changed();
+			sock->incoming.error = error;
+			if (arrivals != nullptr)
+				arrivals->signal();
+			SET_ERROR_CODE(error);
+			return false;
+		}
+		return true;
+	}
+
+	// Datagrams are read by the pool so their sources are known
+	if (!poller_.add(sock->id, sock, sock->type == SOCK_STREAM))
+		return false;
+	
+	// Sockets become writable once connected, or report errors when failed
+	if (sock->connection == Socket::CONNECTING)
+		poller_.watch(sock->id, sock, true, true);
+
+	sockets_.insert(sock);
+	if (thread_.active())
+		changed();
 	else
-		beacon_.signal();
+		thread_.start();
+	return true;
 }
 
 void Pool::remove(Socket *sock)
 {
 	Mutex::Lock lock(guard_);
 
-	if (sockets_.erase(sock))
-		beacon_.signal();
+	auto race = races_.find(sock);
+	if (race != races_.end())
+	{
+		abandon(race->second);
+		races_.erase(race);
+		changed();
+	}
 
-	// Signalling might not be necessary for windows: closing sockets might
-	// already trigger select.
+	if (sockets_.erase(sock))
+	{
+		poller_.remove(sock->id);
+		changed();
+	}
+	closing_.erase(sock);
+	unpause(sock);
 }
 
 void Pool::clear()
 {
 	Mutex::Lock lock(guard_);
 
+	for (Socket *sock : sockets_)
+		poller_.remove(sock->id);
 	sockets_.clear();
+	for (auto &entry : races_)
+		abandon(entry.second);
+	races_.clear();
+	while (!lingering_.empty())
+		bury(lingering_.begin()->first);
+	closing_.clear();
+	paused -= paused_.size();
+	paused_.clear();
+	held_ = 0;
+	changed();
+}
+
+//------------------------------------------------------------------------------
+
+void Pool::changed()
+{
+	// Signals are coalesced, so many changes in a row cost a single wake-up.
+	// A thread that is not needed anymore has to wake up to finish as well.
+	if (poller_.deferred() || (sockets_.empty() && races_.empty() && !persistent_))
+		beacon_.signal();
+}
+
+//------------------------------------------------------------------------------
+
+bool Pool::flush(Socket *sock)
+{
+	Mutex::Lock lock(guard_);
+
+	// Sockets that race are flushed once their connection is claimed
+	if (races_.count(sock))
+		return true;
+
+	if (!sockets_.count(sock))
+	{
+		// Nobody else consumes the data of sockets outside of the pool
+		drop(sock);
+		SET_ERROR(NOTCONN);
+		return false;
+	}
+
+	// Note: the socket stops being watched once its data is sent
+	poller_.watch(sock->id, sock, !paused_.count(sock), true);
+	changed();
+	return true;
+}
+
+bool Pool::retire(Socket *sock, long linger)
+{
+	Mutex::Lock lock(guard_);
+
+	if (!sockets_.count(sock))
+		return false;
+
+	// The socket belongs to the script, which may dispose of it any time; a
+	// husk of our own takes over its connection and the data left to send.
+	// Note: data received meanwhile is discarded like all that follows.
+	Socket *husk = new Socket {sock->id, sock->domain, sock->type,
+		sock->protocol, 0, nullptr, nullptr};
+	poller_.remove(sock->id);
+	sockets_.erase(sock);
+	closing_.erase(sock);
+	unpause(sock);
+
+	Buffer::Chunk chunk;
+	while (sock->outgoing.gather(&chunk, 1) > 0)
+	{
+		husk->outgoing.push(chunk.data, chunk.size);
+		sock->outgoing.consume(chunk.size);
+	}
+	husk->unsent = husk->outgoing.size();
+	sock->unsent = 0;
+
+	// A connection that cannot be watched is closed right away instead
+	if (!poller_.add(husk->id, husk, true))
+	{
+		closesocket(husk->id);
+		delete husk;
+		changed();
+		return true;
+	}
+	sockets_.insert(husk);
+	lingering_[husk] = Clock::now() + std::chrono::milliseconds(linger);
+
+	// Sending is shut down once the data is sent, see write()
+	if (husk->unsent > 0)
+	{
+		closing_.insert(husk);
+		poller_.watch(husk->id, husk, true, true);
+	}
+	else
+		::shutdown(husk->id, SD_SEND);
+
+	// The thread has to learn when to give up on the connection
 	beacon_.signal();
+	return true;
+}
+
+void Pool::resume()
+{
+	// Other shards are left alone, so their readers are not held up
+	if (!held_)
+		return;
+	
+	Mutex::Lock lock(guard_);
+
+	bool resumed = false;
+	for (auto it = paused_.begin(); it != paused_.end(); )
+	{
+		Socket *sock = *it;
+		if (full(sock))
+		{
+			++it;
+			continue;
+		}
+
+		poller_.watch(sock->id, sock, true, sock->unsent > 0);
+		it = paused_.erase(it);
+		--held_;
+		--paused;
+		resumed = true;
+	}
+
+	if (resumed)
+		changed();
+}
+
+void Pool::race(Socket *sock, const std::string &node,
+	const std::string &service)
+{
+	Mutex::Lock lock(guard_);
+
+	auto it = races_.find(sock);
+	if (it != races_.end())
+		abandon(it->second);
+	races_[sock] = Race {node, service, {}, 0, {}, Clock::now(),
+		INVALID_SOCKET, AF_UNSPEC, 0, false, false};
+
+	// The thread starts the first attempt once the host is found
+	if (thread_.active())
+		beacon_.signal();
+	else
+		thread_.start();
+}
+
+bool Pool::claim(Socket *sock, SOCKET &id, int &family, int &error)
+{
+	Mutex::Lock lock(guard_);
+
+	auto it = races_.find(sock);
+	if (it == races_.end() || !it->second.done)
+		return false;
+
+	id = it->second.winner;
+	family = it->second.family;
+	error = it->second.error;
+	races_.erase(it);
+	changed();
+	return true;
 }
 
 Pool::operator bool()
 {
 	Mutex::Lock lock(guard_);
 
-	if ((sockets_.size() > 0) && !thread_.active())
+	if ((sockets_.size() > 0 || persistent_) && !thread_.active())
 		return false;
 
 	for (Socket *sock : sockets_)
@@ -6,16 +6,24 @@
  * Date: 14:41 2019-2-9                                *
  *                                                     *
  * Description: Provides a threaded read cycle that    *
- *              fills the incoming data buffer for a   *
+ *              fills the incoming data buffer and     *
+ *              flushes the outgoing data buffer for a *
  *              pool of sockets.                       *
  *******************************************************/
 
 #ifndef _POOL_H
 #define _POOL_H
 
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 #include "API.h"
+#include "Poller.h"
 #include "Socket.h"
 
 namespace AGSSock {
@@ -25,32 +33,164 @@ namespace AGSSock {
 //! Sockets pool
 
 //! Allows sockets to be registered to a pool for which the incoming data is
-//! processed by a threaded read cycle.
-//! \warning Lock the pool when using id, protocol or the incoming buffer of
-//! a socket when it is registered to the pool to prevent race-conditions.
+//! processed by a threaded read cycle. The thread either runs only while
+//! there are sockets to process, or for the entire lifetime of the pool so
+//! that sockets come and go without creating threads.
+//! The read cycle is the only producer of the incoming buffer of pool sockets,
+//! which may be consumed by another thread without locking. Likewise it is the
+//! only consumer of the outgoing buffer, which it sends once writable.
+//! \warning The id and type of a socket should not change while it is
+//! registered. The pool lock only guards which sockets are registered; it
+//! is held while the read cycle processes them.
 class Pool
 {
 	using Mutex = AGSSockAPI::Mutex;
 	using Beacon = AGSSockAPI::Beacon;
+	using Poller = AGSSockAPI::Poller;
 	using Thread = AGSSockAPI::Thread;
 	using Sockets = std::unordered_set<Socket *>;
+	using Clock = std::chrono::steady_clock;
+
+	//! A connection raced over the addresses of a host, see race()
+	struct Race
+	{
+		std::string node, service;           //!< The host to look up
+		std::vector<SOCKADDR_STORAGE> addrs; //!< In the order they are tried
+		size_t next;                         //!< The address tried next
+		std::vector<SOCKET> attempts;        //!< Connections in progress
+		Clock::time_point due;               //!< When the next one starts anyway
+		SOCKET winner;                       //!< The connection made, if done
+		int family;                          //!< The address family of winner
+		int error;                           //!< Why the last attempt failed
+		bool done;                           //!< Whether it awaits claim()
+		bool requested;                      //!< Whether the lookup was asked for
+	};
 
 	// Note: the order ensures the destructors are called in the right order.
 	// Failing to do so may cause race-conditions.
 	Sockets sockets_; //!< The set of all registered sockets.
-	Mutex guard_;     //!< Guards the pool, pool signal and the incoming buffers
+	Sockets closing_; //!< Sockets to shut down once their data is sent
+	Sockets paused_;  //!< Sockets not read until the script catches up
+	//! Size of paused_, which resume() reads without taking the lock
+	std::atomic<size_t> held_;
+	std::unordered_map<Socket *, Race> races_; //!< By the racing socket
+	//! Closed connections the pool owns until the remote host closes them as
+	//! well, by when it gives up; see retire()
+	std::unordered_map<Socket *, Clock::time_point> lingering_;
+
+	//! Datagrams read from a socket in a single call, if supported
+	enum { BATCH = 32, DATAGRAM = 65536 };
+	std::unique_ptr<char[]> batch_; //!< Receives datagrams, allocated lazily
+
+	//! Amount read that is large enough to hand over the string it was read
+	//! in rather than copying it; below it the string the next read needs
+	//! costs more than the copy does (see bench-buffer)
+	enum { HANDOFF = 32768 };
+	Bytes chunk_; //!< Receives data that is not read in batches
+
+	bool persistent_; //!< Whether the thread keeps running without sockets
+	bool stopping_;   //!< Whether the thread should finish for good
+	Mutex guard_;     //!< Guards the pool and pool signal
 	Beacon beacon_;   //!< Signals addition or removal of sockets in the pool
+	Poller poller_;   //!< Reports which of the pool sockets are ready
 	Thread thread_;   //!< Thread that processes incoming data of pool sockets
 
-	void run(); //!< Read cycle for pool sockets
+	void run();          //!< Read cycle for pool sockets
+	void read(Socket *); //!< Reads incoming data of a ready socket
+	//! Looks at the connections a racing socket attempts, after one of them
+	//! became ready
+	void contend(Socket *);
+	//! Starts the connection attempts that are due
+	//! \return the milliseconds until the next one is, or -1 if none
+	long pace();
+	//! Ends a race, closing all connections but the winner
+	//! \param winner the connection made, or INVALID_SOCKET if none
+	void settle(Socket *, Race &, SOCKET winner);
+	//! Closes all connections of a race
+	void abandon(Race &);
+	//! Closes the connections that lingered long enough
+	//! \return the milliseconds until the next one has, or -1 if none
+	long expire();
+	//! Unregisters, closes and deletes a lingering connection
+	void bury(Socket *);
+	//! Adapts the amount read at once from a socket to the amount last read
+	size_t adapt(Socket *, long ret);
+	void read_batch(Socket *); //!< Reads incoming datagrams of a ready socket
+	void write(Socket *); //!< Sends outgoing data of a writable socket
+	//! Finishes the connection of a socket that became writable, or reports
+	//! why it could not be made
+	void connected(Socket *);
+	void drop(Socket *); //!< Discards outgoing data that cannot be sent
+	bool full(Socket *); //!< Whether a socket holds as much as it may
+	//! Counts data that is about to be stored in the socket buffer
+	//! \return false if it should be dropped instead
+	bool admit(Socket *, size_t amount);
+	//! Stops reading a stream socket that is full, so the sender slows down
+	void throttle(Socket *);
+	//! Forgets that a socket was paused, if it was
+	void unpause(Socket *);
+	//! Wakes up the thread if it has to act on changes to the pool
+	void changed();
+	//! Stores the outcome of a read operation in the socket buffer
+	//! \param source the sender of a datagram, if known
+	void deliver(Socket *, const char *data, long ret, int error,
+		const SOCKADDR_STORAGE *source = nullptr);
+	//! Like the above, large amounts of data are taken over from the string
+	void deliver(Socket *, Bytes &data, long ret, int error,
+		const SOCKADDR_STORAGE *source = nullptr);
 
 	public:
-	Pool() : thread_([this]() { run(); }) {}
-
-	void add(Socket *);    //!< Registers a socket at the pool for processing
+	//! \param persistent whether the thread is started right away and kept
+	//! running until the pool is destroyed, rather than started on demand
+	explicit Pool(bool persistent = false);
+	~Pool(); //!< Waits for the thread to finish
+
+	//! Registers a socket at the pool for processing
+	//! Sockets that are still connecting are watched for being writable; the
+	//! read cycle then updates their connection state.
+	//! \return false if the socket could not be watched; see GET_ERROR()
+	bool add(Socket *);
 	void remove(Socket *); //!< Unregisters a previously added socket
 	void clear();          //!< Unregisters all pool sockets
 
+	//! Has the read cycle send the outgoing data of a socket once writable
+	//! \return false if the socket is not registered; the data is dropped.
+	bool flush(Socket *);
+	//! Takes over the connection of a socket to close it gracefully: its
+	//! outgoing data is sent, then sending is shut down and incoming data is
+	//! discarded until the remote host closes the connection as well.
+	//! \param linger the milliseconds after which it is closed regardless
+	//! \return false if the socket is not registered; it is left untouched.
+	//! \note The socket is unregistered and should be invalidated after.
+	bool retire(Socket *, long linger);
+	//! Resumes reading the sockets that are no longer full
+	//! \note Returns at once without locking if no socket is paused.
+	void resume();
+
+	//! Connects a socket to whichever address of a host answers first, after
+	//! looking it up in the background. Addresses are tried in turn without
+	//! waiting for earlier ones to fail, alternating families (RFC 8305).
+	//! \note The socket is not registered; whoever claims the outcome does.
+	void race(Socket *, const std::string &node, const std::string &service);
+	//! Hands over the connection a socket raced for, once the race is done
+	//! \param id receives the connection, or INVALID_SOCKET if none was made
+	//! \param error receives why not
+	//! \return false while racing, or if the socket does not race
+	bool claim(Socket *, SOCKET &id, int &family, int &error);
+
+	//! Amount of received data the script has yet to read, of all pools
+	static std::atomic<size_t> unread;
+	//! Amount of unread data at which all pools stop reading; zero for none
+	static std::atomic<size_t> unread_limit;
+	//! Number of sockets that are not read because they are full
+	static std::atomic<size_t> paused;
+	//! Signalled whenever data, an error or a connection arrives for any pool
+	//! socket, so a waiting owner wakes up; none if null. Set while no pool
+	//! reads.
+	//! \note Every pool thread signals it without a common lock, which the
+	//! beacon allows while its owner resets it.
+	static Beacon *arrivals;
+
 	//! Returns whether the threaded read cycle is currently active
 	bool active() { return thread_.active(); }
 
@@ -0,0 +1,425 @@
+/*************************************************************
+ * Address resolver -- See header file for more information. *
+ *************************************************************/
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+
+#include "Resolver.h"
+
+namespace AGSSock {
+namespace Resolver {
+
+using namespace AGSSockAPI;
+using std::string;
+using Clock = std::chrono::steady_clock;
+
+// Amount of lookups remembered; the ones that expired go first
+const size_t CAPACITY = 256;
+
+//------------------------------------------------------------------------------
+
+struct Query
+{
+	string node, service;
+	int family;
+	bool reverse;          //!< Whether the names of addr are looked up
+	SOCKADDR_STORAGE addr;
+};
+
+struct Entry
+{
+	Status status;
+	Addresses addrs;           //!< Found by name, in the order preferred
+	string host;               //!< Found by address
+	Clock::time_point expires; //!< Not used while pending
+	std::vector<Beacon *> waiting; //!< Signalled once no longer pending
+};
+
+using Cache = std::unordered_map<string, Entry>;
+
+struct Global
+{
+	Mutex mutex;                    //!< Guards the fields below
+	Cache cache;                    //!< Lookups by name, by key()
+	Cache names;                    //!< Host names by address, by key()
+	std::deque<Query> queue;        //!< Lookups for the thread
+	std::unique_ptr<Thread> thread; //!< Started on demand
+	bool stopping = false;          //!< Whether the thread should stop
+	Beacon beacon;                  //!< Signals queued lookups
+};
+
+// Note: never destroyed, the thread is stopped by clear().
+Global &global()
+{
+	static Global *instance = new Global();
+	return *instance;
+}
+
+//------------------------------------------------------------------------------
+
+inline string key(const string &node, const string &service, int family)
+{
+	// Note: names contain neither of these separators
+	return node + '\n' + service + '\n' + std::to_string(family);
+}
+
+inline string key(const SOCKADDR_STORAGE &addr)
+{
+	// Note: only the parts that tell hosts apart, the rest may be garbage. The
+	//       port is left out, as each connection of a host comes from another.
+	string k(1, (char) addr.ss_family);
+	if (addr.ss_family == AF_INET)
+	{
+		const sockaddr_in &in = reinterpret_cast<const sockaddr_in &> (addr);
+		k.append(reinterpret_cast<const char *> (&in.sin_addr), sizeof (in.sin_addr));
+	}
+	else if (addr.ss_family == AF_INET6)
+	{
+		const sockaddr_in6 &in = reinterpret_cast<const sockaddr_in6 &> (addr);
+		k.append(reinterpret_cast<const char *> (&in.sin6_addr), sizeof (in.sin6_addr));
+		k.append(reinterpret_cast<const char *> (&in.sin6_scope_id), sizeof (in.sin6_scope_id));
+	}
+	return k;
+}
+
+//! Asks the system for an address, which may take a while
+Entry lookup(const string &node, const string &service, int family)
+{
+	addrinfo hint, *result = nullptr;
+	memset(&hint, 0, sizeof (addrinfo));
+	hint.ai_flags = AI_ADDRCONFIG | AI_V4MAPPED | (node.empty() ? AI_PASSIVE : 0);
+	hint.ai_family = family;
+
+	Entry entry = {};
+	if (getaddrinfo(node.c_str(), service.c_str(), &hint, &result) || !result)
+	{
+		entry.status = FAILED;
+		entry.expires = Clock::now() + std::chrono::seconds(RESOLVE_FAILED_TTL);
+		return entry;
+	}
+
+	// Every address is listed once for each socket type, those are skipped
+	entry.status = FOUND;
+	entry.expires = Clock::now() + std::chrono::seconds(RESOLVE_TTL);
+	std::vector<string> seen;
+	for (addrinfo *info = result; info != nullptr; info = info->ai_next)
+	{
+		SOCKADDR_STORAGE addr = {};
+		memcpy(&addr, info->ai_addr,
+			MIN(info->ai_addrlen, sizeof (SOCKADDR_STORAGE)));
+		string k = key(addr);
+		if (std::find(seen.begin(), seen.end(), k) != seen.end())
+			continue;
+		seen.push_back(k);
+		entry.addrs.push_back(addr);
+	}
+	freeaddrinfo(result);
+	return entry;
+}
+
+//! Asks the system for the name of the host at an address, which may take a
+//! while
+Entry lookup(const SOCKADDR_STORAGE &addr)
+{
+	char host[NI_MAXHOST];
+	Entry entry = {};
+
+	if (getnameinfo(CONST_ADDR(&addr), ADDR_SIZE(&addr),
+		host, sizeof (host), nullptr, 0, 0))
+	{
+		entry.status = FAILED;
+		entry.expires = Clock::now() + std::chrono::seconds(RESOLVE_FAILED_TTL);
+		return entry;
+	}
+
+	entry.status = FOUND;
+	entry.expires = Clock::now() + std::chrono::seconds(RESOLVE_TTL);
+	entry.host = host;
+	return entry;
+}
+
+//! Gives the name of the port of an address, or its number if it has none
+//! \note The system knows service names itself, so this never waits for the
+//! network; it is not remembered as it differs for every connection.
+string service_of(const SOCKADDR_STORAGE &addr)
+{
+	char serv[NI_MAXSERV];
+
+	// Note: the port is at the same place for IPv6.
+	if (getnameinfo(CONST_ADDR(&addr), ADDR_SIZE(&addr),
+		nullptr, 0, serv, sizeof (serv), NI_NUMERICHOST))
+		return std::to_string(
+			ntohs(reinterpret_cast<const sockaddr_in &> (addr).sin_port));
+	return serv;
+}
+
+//! Remembers a lookup, making room if needed
+//! Those waiting for it to be done are signalled.
+//! \note Call with the mutex locked
+void store(Cache &cache, const string &key, const Entry &entry)
+{
+	auto it = cache.find(key);
+	if (it != cache.end())
+		for (Beacon *beacon : it->second.waiting)
+			beacon->signal();
+
+	auto now = Clock::now();
+	if (cache.size() >= CAPACITY && !cache.count(key))
+	{
+		for (auto it = cache.begin(); it != cache.end(); )
+			if (it->second.status != PENDING && it->second.expires <= now)
+				it = cache.erase(it);
+			else
+				++it;
+
+		// Otherwise any lookup that is done will do
+		for (auto it = cache.begin();
+			cache.size() >= CAPACITY && it != cache.end(); )
+			if (it->second.status != PENDING)
+				it = cache.erase(it);
+			else
+				++it;
+	}
+	cache[key] = entry;
+}
+
+//! Finds a remembered lookup that has not expired
+//! \note Call with the mutex locked
+inline const Entry *find(Cache &cache, const string &key)
+{
+	auto it = cache.find(key);
+	if (it == cache.end())
+		return nullptr;
+	if (it->second.status != PENDING && it->second.expires <= Clock::now())
+		return nullptr;
+	return &it->second;
+}
+
+//------------------------------------------------------------------------------
+
+//! Looks up queued addresses until stopped
+void run()
+{
+	Global &g = global();
+
+	for (;;)
+	{
+		// Reset first, so lookups queued meanwhile are not missed
+		g.beacon.reset();
+
+		Query query;
+		{
+			Mutex::Lock lock(g.mutex);
+
+			// The thread is waited for when it is destroyed
+			if (g.stopping)
+				return;
+
+			if (g.queue.empty())
+				query.family = -1;
+			else
+			{
+				query = g.queue.front();
+				g.queue.pop_front();
+			}
+		}
+
+		if (query.family == -1)
+		{
+			SOCKET beacon = g.beacon;
+			waitreadable(&beacon, 1, -1);
+			continue;
+		}
+
+		if (query.reverse)
+		{
+			Entry entry = lookup(query.addr);
+
+			Mutex::Lock lock(g.mutex);
+			store(g.names, key(query.addr), entry);
+		}
+		else
+		{
+			Entry entry = lookup(query.node, query.service, query.family);
+
+			Mutex::Lock lock(g.mutex);
+			store(g.cache, key(query.node, query.service, query.family), entry);
+		}
+	}
+}
+
+//! Has the thread do a lookup, which is pending until it is done
+//! \note Call with the mutex locked
+void queue(Global &g, Cache &cache, const string &key, const Query &query,
+	Beacon *notify)
+{
+	Entry pending = {};
+	pending.status = PENDING;
+	if (notify != nullptr)
+		pending.waiting.push_back(notify);
+	store(cache, key, pending);
+	g.queue.push_back(query);
+
+	if (!g.thread)
+	{
+		g.stopping = false;
+		g.thread.reset(new Thread(run));
+		g.thread->start();
+	}
+	g.beacon.signal();
+}
+
+//==============================================================================
+
+Status resolve(const string &node, const string &service, int family,
+	Addresses &addrs)
+{
+	Global &g = global();
+	string k = key(node, service, family);
+
+	{
+		Mutex::Lock lock(g.mutex);
+
+		// Note: a pending lookup is not waited for, we look it up ourselves
+		const Entry *entry = find(g.cache, k);
+		if (entry != nullptr && entry->status != PENDING)
+		{
+			addrs = entry->addrs;
+			return entry->status;
+		}
+	}
+
+	Entry entry = lookup(node, service, family);
+	addrs = entry.addrs;
+
+	Mutex::Lock lock(g.mutex);
+	store(g.cache, k, entry);
+	return entry.status;
+}
+
+Status resolve(const string &node, const string &service, int family,
+	SOCKADDR_STORAGE &addr)
+{
+	Addresses addrs;
+	Status status = resolve(node, service, family, addrs);
+	if (status == FOUND)
+		addr = addrs.front();
+	return status;
+}
+
+Status resolve(const SOCKADDR_STORAGE &addr, string &host, string &service)
+{
+	Global &g = global();
+	string k = key(addr);
+
+	{
+		Mutex::Lock lock(g.mutex);
+
+		// See above for pending lookups
+		const Entry *entry = find(g.names, k);
+		if (entry != nullptr && entry->status != PENDING)
+		{
+			host = entry->host;
+			service = service_of(addr);
+			return entry->status;
+		}
+	}
+
+	Entry entry = lookup(addr);
+	host = entry.host;
+	service = service_of(addr);
+
+	Mutex::Lock lock(g.mutex);
+	store(g.names, k, entry);
+	return entry.status;
+}
+
+//------------------------------------------------------------------------------
+
+Status request(const string &node, const string &service, int family,
+	Addresses &addrs, Beacon *notify)
+{
+	Global &g = global();
+	string k = key(node, service, family);
+	Mutex::Lock lock(g.mutex);
+
+	auto it = g.cache.find(k);
+	const Entry *entry = find(g.cache, k);
+	if (entry != nullptr)
+	{
+		// Note: each beacon is signalled once, however often it asks
+		std::vector<Beacon *> &waiting = it->second.waiting;
+		if (entry->status == PENDING && notify != nullptr
+			&& std::find(waiting.begin(), waiting.end(), notify) == waiting.end())
+			waiting.push_back(notify);
+		addrs = entry->addrs;
+		return entry->status;
+	}
+
+	Query query = {node, service, family, false};
+	queue(g, g.cache, k, query, notify);
+	return PENDING;
+}
+
+Status request(const string &node, const string &service, int family,
+	SOCKADDR_STORAGE &addr)
+{
+	Addresses addrs;
+	Status status = request(node, service, family, addrs);
+	if (status == FOUND)
+		addr = addrs.front();
+	return status;
+}
+
+Status request(const SOCKADDR_STORAGE &addr, string &host, string &service)
+{
+	Global &g = global();
+	string k = key(addr);
+	Mutex::Lock lock(g.mutex);
+
+	const Entry *entry = find(g.names, k);
+	if (entry != nullptr)
+	{
+		host = entry->host;
+		service = service_of(addr);
+		return entry->status;
+	}
+
+	Query query = {string(), string(), 0, true, addr};
+	queue(g, g.names, k, query, nullptr);
+	return PENDING;
+}
+
+//------------------------------------------------------------------------------
+
+void clear()
+{
+	Global &g = global();
+	std::unique_ptr<Thread> thread;
+
+	{
+		Mutex::Lock lock(g.mutex);
+
+		g.stopping = true;
+		g.beacon.signal();
+		thread.swap(g.thread);
+		g.queue.clear();
+		g.cache.clear();
+		g.names.clear();
+	}
+
+	// Waited for outside of the lock, which a lookup in progress takes
+	thread.reset();
+}
+
+//------------------------------------------------------------------------------
+
+} /* namespace Resolver */
+} /* namespace AGSSock */
+
+//..............................................................................
@@ -0,0 +1,98 @@
+/*******************************************************
+ * Address resolver -- header file                     *
+ *                                                     *
+ * Author: agent                                       *
+ *                                                     *
+ * Date: 19:12 2026-10-18                              *
+ *                                                     *
+ * Description: Looks up addresses by name, possibly   *
+ *              in the background, and remembers them  *
+ *              so the game does not wait for the same *
+ *              lookup twice.                          *
+ *******************************************************/
+
+#ifndef _RESOLVER_H
+#define _RESOLVER_H
+
+#include <string>
+#include <vector>
+
+#include "API.h"
+
+// Seconds a lookup is remembered, and a failed lookup
+// Note: the system does not tell how long an address is valid for.
+#ifndef RESOLVE_TTL
+	#define RESOLVE_TTL 60
+#endif
+#ifndef RESOLVE_FAILED_TTL
+	#define RESOLVE_FAILED_TTL 10
+#endif
+
+namespace AGSSock {
+
+//------------------------------------------------------------------------------
+
+//! Cached address lookups
+
+//! Lookups are remembered by node, service and address family, and the other
+//! way around by address; host names regardless of the port. Those that are requested rather than resolved are
+//! done by a background thread, which is started on demand.
+//! \note Pending lookups can signal a beacon once done, so a thread can wait
+//! for them along with its sockets.
+namespace Resolver {
+
+//! The outcome of a lookup
+enum Status
+{
+	FOUND,  //!< The address is known
+	FAILED, //!< The address does not exist or could not be looked up
+	PENDING //!< The address is being looked up in the background
+};
+
+//! The addresses found for a name
+using Addresses = std::vector<SOCKADDR_STORAGE>;
+
+//! Looks up an address, waiting for it unless it is remembered
+//! \param family the address family, or AF_UNSPEC for any
+//! \param addr receives the address if found
+Status resolve(const std::string &node, const std::string &service,
+	int family, SOCKADDR_STORAGE &addr);
+
+//! Like the above, but all addresses are kept in the order the system
+//! prefers them
+Status resolve(const std::string &node, const std::string &service,
+	int family, Addresses &addrs);
+
+//! Like resolve but never waits: a lookup is started in the background
+//! instead, and PENDING returned until it finished.
+Status request(const std::string &node, const std::string &service,
+	int family, SOCKADDR_STORAGE &addr);
+
+//! Like the above for all addresses
+//! \param notify signalled once a pending lookup is done, if not null
+Status request(const std::string &node, const std::string &service,
+	int family, Addresses &addrs, AGSSockAPI::Beacon *notify = nullptr);
+
+//! Looks up the names of an address, waiting for them unless remembered
+//! \param host receives the name of the host, or its number if it has none
+//! \param service receives the name of the port, or its number if it has
+//! none; this is never waited for.
+Status resolve(const SOCKADDR_STORAGE &addr, std::string &host,
+	std::string &service);
+
+//! Like the above but never waits, see request.
+Status request(const SOCKADDR_STORAGE &addr, std::string &host,
+	std::string &service);
+
+//! Stops the background thread and forgets all lookups
+void clear();
+
+} /* namespace Resolver */
+
+//------------------------------------------------------------------------------
+
+} /* namespace AGSSock */
+
+#endif /* _RESOLVER_H */
+
+//..............................................................................
@@ -0,0 +1,48 @@
+/**********************************************************
+ * Data scanning -- See header file for more information. *
+ **********************************************************/
+
+#include <cstring>
+
+#include "Scan.h"
+
+namespace AGSSock {
+
+//------------------------------------------------------------------------------
+
+// Note: C libraries vectorize memchr with the widest instructions available,
+//       faster than hand-written loops past a few dozen bytes.
+const char *scan(const char *begin, const char *end, char c)
+{
+	const void *pos = std::memchr(begin, c, end - begin);
+	return pos != nullptr ? static_cast<const char *> (pos) : end;
+}
+
+//------------------------------------------------------------------------------
+
+const char *scan(const char *begin, const char *end,
+	const char *delimiter, size_t length)
+{
+	if (!length)
+		return begin;
+	if (end - begin < (ptrdiff_t) length)
+		return end;
+
+	// Search for the first character, then verify the rest
+	for (end -= length - 1; begin < end; ++begin)
+	{
+		begin = scan(begin, end, delimiter[0]);
+		if (begin == end)
+			break;
+		if (!std::memcmp(begin + 1, delimiter + 1, length - 1))
+			return begin;
+	}
+
+	return end + length - 1;
+}
+
+//------------------------------------------------------------------------------
+
+} /* namespace AGSSock */
+
+//..............................................................................
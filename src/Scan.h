@@ -0,0 +1,35 @@
+/*******************************************************
+ * Data scanning -- header file                        *
+ *                                                     *
+ * Author: agent                                       *
+ *                                                     *
+ * Date: 11:45 2026-10-18                              *
+ *                                                     *
+ * Description: Searches received data for message     *
+ *              delimiters of one or more characters.  *
+ *******************************************************/
+
+#ifndef _SCAN_H
+#define _SCAN_H
+
+#include <cstddef>
+
+namespace AGSSock {
+
+//------------------------------------------------------------------------------
+
+//! Returns the first occurrence of a character in a range, or end if absent
+const char *scan(const char *begin, const char *end, char c);
+
+//! Returns the first occurrence of a character sequence in a range, or end if
+//! absent
+const char *scan(const char *begin, const char *end,
+	const char *delimiter, size_t length);
+
+//------------------------------------------------------------------------------
+
+} /* namespace AGSSock */
+
+#endif /* _SCAN_H */
+
+//..............................................................................
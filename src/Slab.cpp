@@ -0,0 +1,306 @@
+/***********************************************************
+ * Slab allocator -- See header file for more information. *
+ ***********************************************************/
+
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include <vector>
+
+#include "API.h"
+#include "Slab.h"
+
+namespace AGSSock {
+namespace Slab {
+
+using AGSSockAPI::Mutex;
+using std::memory_order_relaxed;
+
+//------------------------------------------------------------------------------
+
+// Size classes grow by a quarter of the power of two below: 32, 40, 48, 56, 64,
+// 80, ... up to 256 KiB, so at most a fifth of a block is wasted.
+enum { MINIMUM = 32, STEPS = 4, CLASSES = 13 * STEPS + 1 };
+const size_t MAXIMUM = size_t(MINIMUM) << (CLASSES / STEPS);
+
+// Amount of memory kept per size class, in a thread cache and shared
+const size_t LOCAL_BYTES = 64 * 1024;
+const size_t SHARED_BYTES = 1024 * 1024;
+
+inline size_t class_size(size_t index)
+{
+	size_t base = size_t(MINIMUM) << (index / STEPS);
+	return base + (index % STEPS) * (base / STEPS);
+}
+
+inline size_t class_of(size_t size)
+{
+	if (size <= MINIMUM)
+		return 0;
+
+	// Finds the power of two below, then the quarter step that fits
+	size_t base = MINIMUM, octave = 0;
+	while ((base << 1) < size)
+	{
+		base <<= 1;
+		++octave;
+	}
+	size_t quarter = base / STEPS;
+	return octave * STEPS + (size - base + quarter - 1) / quarter;
+}
+
+// Amount of blocks of a class that may be kept
+inline size_t local_limit(size_t index)
+	{ return std::max<size_t>(4, LOCAL_BYTES / class_size(index)); }
+inline size_t shared_limit(size_t index)
+	{ return std::max<size_t>(16, SHARED_BYTES / class_size(index)); }
+
+//------------------------------------------------------------------------------
+
+struct Block
+{
+	Block *next;
+};
+
+// Blocks freed by any thread that are up for grabs
+struct Shared
+{
+	Mutex mutex;
+	Block *head = nullptr;
+	size_t count = 0;
+};
+
+struct Cache;
+
+struct Global
+{
+	Shared lists[CLASSES];
+	std::atomic<size_t> held {0}; //!< Bytes in the shared lists
+
+	Mutex mutex;                 //!< Guards the fields below
+	std::vector<Cache *> caches; //!< Caches of running threads
+	size_t hits = 0, misses = 0; //!< Counted by threads that finished
+};
+
+// Note: never destroyed, threads may return their blocks until the very end.
+Global &global()
+{
+	static Global *instance = new Global();
+	return *instance;
+}
+
+//------------------------------------------------------------------------------
+
+// Increments a counter only its own thread writes to
+inline void bump(std::atomic<size_t> &counter, size_t amount = 1)
+{
+	counter.store(counter.load(memory_order_relaxed) + amount,
+		memory_order_relaxed);
+}
+
+inline void drop(std::atomic<size_t> &counter, size_t amount)
+{
+	counter.store(counter.load(memory_order_relaxed) - amount,
+		memory_order_relaxed);
+}
+
+//------------------------------------------------------------------------------
+
+thread_local bool finished = false; //!< Whether this thread's cache is gone
+
+// Blocks freed by this thread
+struct Cache
+{
+	Block *heads[CLASSES] = {};
+	size_t counts[CLASSES] = {};
+
+	// Note: only written by the owning thread, read by statistics()
+	std::atomic<size_t> hits {0}, misses {0}, held {0};
+
+	Cache()
+	{
+		Global &g = global();
+		Mutex::Lock lock(g.mutex);
+		g.caches.push_back(this);
+	}
+
+	~Cache()
+	{
+		for (size_t i = 0; i < CLASSES; ++i)
+			spill(i, counts[i]);
+		finished = true;
+
+		Global &g = global();
+		Mutex::Lock lock(g.mutex);
+		g.hits += hits.load(memory_order_relaxed);
+		g.misses += misses.load(memory_order_relaxed);
+		for (size_t i = 0; i < g.caches.size(); ++i)
+			if (g.caches[i] == this)
+				g.caches.erase(g.caches.begin() + i--);
+	}
+
+	//! Takes up to half a cache worth of blocks from the shared list
+	void refill(size_t index);
+	//! Gives blocks to the shared list; those that do not fit are freed
+	void spill(size_t index, size_t count);
+};
+
+//------------------------------------------------------------------------------
+
+void Cache::refill(size_t index)
+{
+	Global &g = global();
+	Shared &shared = g.lists[index];
+	size_t size = class_size(index), count = 0;
+	{
+		Mutex::Lock lock(shared.mutex);
+		size_t wanted = local_limit(index) / 2;
+		while (shared.head != nullptr && count < wanted)
+		{
+			Block *block = shared.head;
+			shared.head = block->next;
+			block->next = heads[index];
+			heads[index] = block;
+			++count;
+		}
+		shared.count -= count;
+		g.held.fetch_sub(count * size, memory_order_relaxed);
+	}
+	counts[index] += count;
+	bump(held, count * size);
+}
+
+void Cache::spill(size_t index, size_t count)
+{
+	Global &g = global();
+	Shared &shared = g.lists[index];
+	size_t size = class_size(index), kept = 0;
+	Block *excess = nullptr;
+	{
+		Mutex::Lock lock(shared.mutex);
+		size_t limit = shared_limit(index);
+		for (size_t i = 0; i < count; ++i)
+		{
+			Block *block = heads[index];
+			heads[index] = block->next;
+			if (shared.count < limit)
+			{
+				block->next = shared.head;
+				shared.head = block;
+				++shared.count;
+				++kept;
+			}
+			else
+			{
+				block->next = excess;
+				excess = block;
+			}
+		}
+		g.held.fetch_add(kept * size, memory_order_relaxed);
+	}
+	counts[index] -= count;
+	drop(held, count * size);
+
+	// Freed outside of the lock
+	while (excess != nullptr)
+	{
+		Block *block = excess;
+		excess = block->next;
+		::operator delete(block);
+	}
+}
+
+//------------------------------------------------------------------------------
+
+inline Cache *local()
+{
+	if (finished)
+		return nullptr;
+	thread_local Cache cache;
+	return &cache;
+}
+
+//==============================================================================
+
+void *allocate(size_t size)
+{
+	Cache *cache = local();
+	if (size > MAXIMUM)
+	{
+		if (cache != nullptr)
+			bump(cache->misses);
+		return ::operator new(size);
+	}
+
+	// Note: blocks are always of a class size, they may be recycled elsewhere
+	size_t index = class_of(size);
+	if (cache == nullptr)
+		return ::operator new(class_size(index));
+
+	if (cache->heads[index] == nullptr)
+		cache->refill(index);
+
+	Block *block = cache->heads[index];
+	if (block == nullptr)
+	{
+		bump(cache->misses);
+		return ::operator new(class_size(index));
+	}
+
+	cache->heads[index] = block->next;
+	--cache->counts[index];
+	drop(cache->held, class_size(index));
+	bump(cache->hits);
+	return block;
+}
+
+//------------------------------------------------------------------------------
+
+void deallocate(void *ptr, size_t size)
+{
+	if (ptr == nullptr)
+		return;
+
+	Cache *cache = local();
+	if (size > MAXIMUM || cache == nullptr)
+	{
+		// Note: blocks freed while the thread exits are not recycled
+		::operator delete(ptr);
+		return;
+	}
+
+	size_t index = class_of(size);
+	Block *block = static_cast<Block *> (ptr);
+	block->next = cache->heads[index];
+	cache->heads[index] = block;
+	++cache->counts[index];
+	bump(cache->held, class_size(index));
+
+	// Half the cache goes to the shared list, so the other half remains
+	if (cache->counts[index] > local_limit(index))
+		cache->spill(index, cache->counts[index] / 2);
+}
+
+//------------------------------------------------------------------------------
+
+Statistics statistics()
+{
+	Global &g = global();
+	Mutex::Lock lock(g.mutex);
+
+	Statistics stats = {g.hits, g.misses, g.held.load(memory_order_relaxed)};
+	for (Cache *cache : g.caches)
+	{
+		stats.hits += cache->hits.load(memory_order_relaxed);
+		stats.misses += cache->misses.load(memory_order_relaxed);
+		stats.held += cache->held.load(memory_order_relaxed);
+	}
+	return stats;
+}
+
+//------------------------------------------------------------------------------
+
+} /* namespace Slab */
+} /* namespace AGSSock */
+
+//..............................................................................
@@ -0,0 +1,80 @@
+/*******************************************************
+ * Slab allocator -- header file                       *
+ *                                                     *
+ * Author: agent                                       *
+ *                                                     *
+ * Date: 16:02 2026-10-18                              *
+ *                                                     *
+ * Description: Recycles the memory of received data   *
+ *              in size classes, so that packets do    *
+ *              not burden the heap of the game.       *
+ *******************************************************/
+
+#ifndef _SLAB_H
+#define _SLAB_H
+
+#include <cstddef>
+#include <string>
+
+namespace AGSSock {
+
+//------------------------------------------------------------------------------
+
+//! Size-classed memory recycling
+
+//! Freed blocks are kept in a cache of the thread that freed them, and handed
+//! in batches to a shared list once that cache is full. This suits the pool
+//! threads allocating received data and the game thread freeing it: neither
+//! takes a lock for most blocks.
+//! \note Blocks larger than the largest size class are not recycled.
+namespace Slab {
+
+void *allocate(size_t size);              //!< Allocates a block of memory
+void deallocate(void *ptr, size_t size);  //!< Frees a block of the given size
+
+//! Describes how well the recycling works out
+struct Statistics
+{
+	size_t hits;   //!< Allocations served with a recycled block
+	size_t misses; //!< Allocations that needed fresh memory
+	size_t held;   //!< Bytes kept in free blocks for recycling
+};
+
+//! Returns the counters for all threads combined
+Statistics statistics();
+
+//------------------------------------------------------------------------------
+
+//! Standard allocator interface to recycled memory
+template <typename T> struct Allocator
+{
+	using value_type = T;
+
+	Allocator() {}
+	template <typename U> Allocator(const Allocator<U> &) {}
+
+	T *allocate(size_t n)
+		{ return static_cast<T *> (Slab::allocate(n * sizeof (T))); }
+	void deallocate(T *ptr, size_t n)
+		{ Slab::deallocate(ptr, n * sizeof (T)); }
+
+	template <typename U> bool operator ==(const Allocator<U> &) const
+		{ return true; }
+	template <typename U> bool operator !=(const Allocator<U> &) const
+		{ return false; }
+};
+
+} /* namespace Slab */
+
+//------------------------------------------------------------------------------
+
+//! Byte string stored in recycled memory, used for all data received
+using Bytes = std::basic_string<char, std::char_traits<char>, Slab::Allocator<char>>;
+
+//------------------------------------------------------------------------------
+
+} /* namespace AGSSock */
+
+#endif /* _SLAB_H */
+
+//..............................................................................
@@ -2,16 +2,19 @@
  * Socket address interface -- See header file for more information. *
  *********************************************************************/
 
-#include <stdio.h>
-#include <stdlib.h>
 #include <string.h>
 
 #include <string>
 
+#include "Resolver.h"
 #include "SockAddr.h"
 
 namespace AGSSock {
 
+// How the Address attribute finds names for addresses
+// Note: only script functions use this, which AGS runs on a single thread.
+ags_t lookup_mode = AGSSOCK_LOOKUP_WAIT;
+
 //------------------------------------------------------------------------------
 
 void decode_type(ags_t &type)
@@ -24,6 +27,28 @@ void decode_type(ags_t &type)
 
 //------------------------------------------------------------------------------
 
+void split_address(const char *addr, int family, std::string &node,
+	std::string &service)
+{
+	size_t index;
+	node = addr;
+	
+	if ((index = node.find("://")) != std::string::npos)
+	{
+		service = node.substr(0, index);
+		node = node.substr(index + 3);
+	}
+	
+	if ((family != AF_INET6)
+	&& ((index = node.rfind(':')) != std::string::npos))
+	{
+		service = node.substr(index + 1);
+		node.resize(index);
+	}
+}
+
+//------------------------------------------------------------------------------
+
 int AGSSockAddr::Dispose(const char *addr, bool force)
 {
 	delete (SockAddr *) addr;
@@ -74,6 +99,27 @@ SockAddr *SockAddr_CreateFromString(const char *str, ags_t type)
 
 //------------------------------------------------------------------------------
 
+SockAddr *SockAddr_Lookup(const char *str, ags_t type)
+{
+	decode_type(type);
+	std::string node, service;
+	split_address(str, type, node, service);
+	
+	// Like CreateFromString, failure results in an empty address
+	SOCKADDR_STORAGE found;
+	Resolver::Status status = Resolver::request(node, service,
+		type ? type : AF_UNSPEC, found);
+	if (status == Resolver::PENDING)
+		return nullptr;
+	
+	SockAddr *addr = SockAddr_Create(type);
+	if (status == Resolver::FOUND)
+		memcpy(addr, &found, sizeof (SOCKADDR_STORAGE));
+	return addr;
+}
+
+//------------------------------------------------------------------------------
+
 SockAddr *SockAddr_CreateFromData(const SockData *data)
 {
 	SockAddr *addr = new SockAddr; // by design
@@ -140,75 +186,64 @@ void SockAddr_set_Port(SockAddr *sa, ags_t port)
 
 const char *SockAddr_get_Address(SockAddr *sa)
 {
-	std::string addr;
-	char host[NI_MAXHOST];
-	char serv[NI_MAXSERV];
+	std::string addr, host, service;
+	Resolver::Status status = Resolver::FAILED;
 	
-	if (getnameinfo(ADDR(sa), ADDR_SIZE(sa),
-		host, sizeof (host), serv, sizeof (serv), 0))
+	// Names are looked up as requested; until found the numbers are used
+	if (lookup_mode == AGSSOCK_LOOKUP_WAIT)
+		status = Resolver::resolve(*sa, host, service);
+	else if (lookup_mode == AGSSOCK_LOOKUP_BACKGROUND)
+		status = Resolver::request(*sa, host, service);
+	
+	if (status != Resolver::FOUND)
 	{
-		// It failed: let's try without service names
-		if (getnameinfo(ADDR(sa), ADDR_SIZE(sa),
-			host, sizeof (host), NULL, 0, 0))
-		{
-			// Handle error:
-			// we'll just return an empty string, that will be comforting enough
-		}
+		// Without names the numbers will do; for other types of addresses
+		// we'll just return an empty string, that will be comforting enough
+		char buffer[INET6_ADDRSTRLEN] = "";
+		if (sa->ss_family == AF_INET)
+			inet_ntop(AF_INET, &reinterpret_cast<sockaddr_in *> (sa)->sin_addr,
+				buffer, sizeof (buffer));
+		else if (sa->ss_family == AF_INET6)
+			inet_ntop(AF_INET6, &reinterpret_cast<sockaddr_in6 *> (sa)->sin6_addr,
+				buffer, sizeof (buffer));
 		else
-		{
-			sprintf(serv, "%d", SockAddr_get_Port(sa));
-			addr = (std::string(host) + ":") + serv;
-		}
+			return AGS_STRING("");
+		host = buffer;
+		service = std::to_string(SockAddr_get_Port(sa));
 	}
+	
+	if (service.empty() || service == "0")
+		addr = host;
+	else if (service.find_first_not_of("0123456789") != std::string::npos)
+		addr = (service + "://") + host;
 	else
-	{
-		if (!serv[0] || (serv[0] == '0' && !serv[1]))
-			addr = host;
-		else if (atof(serv) == 0.0) // A bit wonky but does the trick
-			addr = (std::string(serv) + "://") + host;
-		else
-			addr = (std::string(host) + ":") + serv;
-	}
+		addr = (host + ":") + service;
 	
 	return AGS_STRING(addr.c_str());
 }
 
 //------------------------------------------------------------------------------
 
+void SockAddr_SetAddressLookup(ags_t mode)
+{
+	lookup_mode = mode;
+}
+
+//------------------------------------------------------------------------------
+
 void SockAddr_set_Address(SockAddr *sa, const char *addr)
 {
-	std::string node = addr, service;
-	size_t index;
-	
-	if ((index = node.find("://")) != std::string::npos)
-	{
-		service = node.substr(0, index);
-		node = node.substr(index + 3);
-	}
-	
-	if ((sa->ss_family != AF_INET6)
-	&& ((index = node.rfind(':')) != std::string::npos))
-	{
-		service = node.substr(index + 1);
-		node.resize(index);
-	}
-	
-	addrinfo hint, *result = nullptr;
-	memset(&hint, 0, sizeof (addrinfo));
-	hint.ai_flags = AI_ADDRCONFIG | AI_V4MAPPED | (node.empty() ? AI_PASSIVE : 0);
-	hint.ai_family = sa->ss_family ? sa->ss_family : AF_UNSPEC;
+	std::string node, service;
+	split_address(addr, sa->ss_family, node, service);
 	
-	if (getaddrinfo(node.c_str(), service.c_str(), &hint, &result) || !result)
-	{
-		// Handle error:
-		// We'll simply do nothing when address resolving failed;
-		// Users will figure out that the address object is empty,
-		// so the address string supplied is most likely invalid.
-		return;
-	}
-
-	memcpy(sa, result->ai_addr, result->ai_addrlen);
-	freeaddrinfo(result);
+	// Handle error:
+	// We'll simply do nothing when address resolving failed;
+	// Users will figure out that the address object is empty,
+	// so the address string supplied is most likely invalid.
+	SOCKADDR_STORAGE found;
+	if (Resolver::resolve(node, service,
+		sa->ss_family ? sa->ss_family : AF_UNSPEC, found) == Resolver::FOUND)
+		memcpy(sa, &found, sizeof (SOCKADDR_STORAGE));
 }
 
 //------------------------------------------------------------------------------
@@ -254,7 +289,7 @@ SockData *SockAddr_GetData(SockAddr *sa)
 {
 	SockData *data = new SockData();
 	AGS_OBJECT(SockData, data);
-	data->data = std::string(reinterpret_cast<char *> (sa), ADDR_SIZE(sa));
+	data->data.assign(reinterpret_cast<char *> (sa), ADDR_SIZE(sa));
 	return data;
 }
 
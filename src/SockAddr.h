@@ -12,9 +12,16 @@
 #ifndef _SOCKADDR_H
 #define _SOCKADDR_H
 
+#include <string>
+
 #include "API.h"
 #include "SockData.h"
 
+// How the Address attribute finds names for addresses
+#define AGSSOCK_LOOKUP_NUMERIC    0
+#define AGSSOCK_LOOKUP_WAIT       1
+#define AGSSOCK_LOOKUP_BACKGROUND 2
+
 namespace AGSSock {
 
 //------------------------------------------------------------------------------
@@ -29,6 +36,8 @@ AGS_DEFINE_CLASS(SockAddr)
 
 SockAddr *SockAddr_Create(ags_t type);
 SockAddr *SockAddr_CreateFromString(const char *, ags_t type);
+SockAddr *SockAddr_Lookup(const char *, ags_t type);
+void SockAddr_SetAddressLookup(ags_t mode);
 SockAddr *SockAddr_CreateFromData(const SockData *);
 SockAddr *SockAddr_CreateIP(const char *addr, ags_t port);
 SockAddr *SockAddr_CreateIPv6(const char *addr, ags_t port);
@@ -42,6 +51,11 @@ void SockAddr_set_IP(SockAddr *, const char *);
 
 SockData *SockAddr_GetData(SockAddr *);
 
+//! Splits an address string like "http://localhost:8080" into the node and
+//! service to look up.
+void split_address(const char *addr, int family, std::string &node,
+	std::string &service);
+
 //------------------------------------------------------------------------------
 
 } /* namespace AGSSock */
@@ -54,12 +68,23 @@ SockData *SockAddr_GetData(SockAddr *);
 	"#define IPv4 -1\r\n" \
 	"#define IPv6 -2\r\n" \
 	"\r\n" \
+	"enum SockLookup\r\n" \
+	"{\r\n" \
+	"  eSockLookupNumeric    = " STRINGIFY(AGSSOCK_LOOKUP_NUMERIC) ",\r\n" \
+	"  eSockLookupWait       = " STRINGIFY(AGSSOCK_LOOKUP_WAIT) ",\r\n" \
+	"  eSockLookupBackground = " STRINGIFY(AGSSOCK_LOOKUP_BACKGROUND) "\r\n" \
+	"};\r\n" \
+	"\r\n" \
 	"managed struct SockAddr\r\n" \
 	"{\r\n" \
 	"  /// Creates an empty socket address. (advanced: set type to IPv6 if you're using IPv6).\r\n" \
 	"  import static SockAddr *Create(int type = IPv4);                                 // $AUTOCOMPLETESTATICONLY$\r\n" \
 	"  /// Creates a socket address from a string. (for example: \"http://www.adventuregamestudio.co.uk\")\r\n" \
 	"  import static SockAddr *CreateFromString(const string address, int type = IPv4); // $AUTOCOMPLETESTATICONLY$\r\n" \
+	"  /// Like CreateFromString, but looks the address up in the background. Returns null while looking: call it again later.\r\n" \
+	"  import static SockAddr *Lookup(const string address, int type = IPv4);           // $AUTOCOMPLETESTATICONLY$\r\n" \
+	"  /// Sets how Address finds the names of addresses: not at all, waiting for them or in the background.\r\n" \
+	"  import static void SetAddressLookup(SockLookup mode);                            // $AUTOCOMPLETESTATICONLY$\r\n" \
 	"  /// Creates a socket address from raw data. (advanced)\r\n" \
 	"  import static SockAddr *CreateFromData(SockData *);                              // $AUTOCOMPLETEIGNORE$\r\n" \
 	"  /// Creates a socket address from an IP-address. (for example: \"127.0.0.1\")\r\n" \
@@ -80,6 +105,8 @@ SockData *SockAddr_GetData(SockAddr *);
 	AGS_CLASS (SockAddr)                         \
 	AGS_METHOD(SockAddr, Create, 1)              \
 	AGS_METHOD(SockAddr, CreateFromString, 2)    \
+	AGS_METHOD(SockAddr, Lookup, 2)              \
+	AGS_METHOD(SockAddr, SetAddressLookup, 1)    \
 	AGS_METHOD(SockAddr, CreateFromData, 1)      \
 	AGS_METHOD(SockAddr, CreateIP, 2)            \
 	AGS_METHOD(SockAddr, CreateIPv6, 2)          \
@@ -14,20 +14,27 @@
 
 #include <string>
 
+#include "Slab.h"
+
 namespace AGSSock {
 
 //------------------------------------------------------------------------------
 //! Binary data wrapper
 struct SockData
 {
-	std::string data; //!< internal data representation
+	Bytes data; //!< internal data representation
 	
 	//! Creates an empty data object
 	SockData() {}
 	//! Creates a data object of specified length and optionally filled with a specific char value
-	SockData(size_t size, char c = '\0') : data(std::string(size, c)) {}
+	SockData(size_t size, char c = '\0') : data(size, c) {}
 	//! Creates a data object from a string object
-	SockData(const std::string &D) : data(D) {}
+	SockData(const std::string &D) : data(D.data(), D.size()) {}
+	
+	//! Data objects are created for every packet, so their memory is recycled
+	static void *operator new(size_t size) { return Slab::allocate(size); }
+	static void operator delete(void *ptr, size_t size)
+		{ Slab::deallocate(ptr, size); }
 };
 
 AGS_DEFINE_CLASS(SockData)
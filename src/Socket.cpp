@@ -2,10 +2,16 @@
  * Socket interface -- See header file for more information. *
  *************************************************************/
 
+#include <algorithm>
+#include <chrono>
 #include <cstdint>
 #include <cstring>
+#include <thread>
+#include <unordered_set>
+#include <vector>
 
 #include "Pool.h"
+#include "Resolver.h"
 #include "Socket.h"
 
 namespace AGSSock {
@@ -17,31 +23,118 @@ using std::int32_t;
 
 //------------------------------------------------------------------------------
 
-Pool *pool;
+// Sockets are spread over several pools, each with its own read thread and
+// lock, so that busy sockets do not contend for a single thread. A socket keeps
+// the pool it was assigned to for its entire lifetime.
+std::vector<Pool *> pools;
+size_t next_pool;
 
-void Initialize()
+// All sockets the script holds, so it can wait for any of them
+// Note: only script functions use this, which AGS runs on a single thread.
+std::unordered_set<Socket *> sockets;
+
+void Initialize(unsigned int shards)
 {
-	pool = new Pool();
+	if (!shards)
+		shards = std::thread::hardware_concurrency();
+	// Note: more read threads rarely pay off for a game
+	shards = std::max(1u, std::min(shards, 8u));
+
+	// Note: with persistent pools, reconnecting does not cost a thread
+	Pool::arrivals = new Beacon();
+	for (unsigned int i = 0; i < shards; ++i)
+		pools.push_back(new Pool(POOL_PERSISTENT));
+	next_pool = 0;
+	Pool::unread_limit = RECEIVE_LIMIT;
 }
 
 void Terminate()
 {
 	// We assume that all managed objects will be disposed of at this point.
-	// That means the pool is or soon will be empty thus the read loop stops.
-	// Deleting the pool gives it two seconds to do it nicely or else just
-	// kills it.
+	// Deleting a pool stops its read loop, which is given two seconds to do so
+	// nicely or else is just killed.
+	// Note: lookups in the background signal the pools waiting for them.
 	
-	delete pool;
-	pool = nullptr;
+	Resolver::clear();
+	for (Pool *pool : pools)
+		delete pool;
+	pools.clear();
+	sockets.clear();
+	delete Pool::arrivals;
+	Pool::arrivals = nullptr;
+}
+
+// Returns the pool serving the socket, the pools are assigned round-robin
+// Note: only script functions call this, which AGS runs on a single thread.
+inline Pool &PoolOf(Socket *sock)
+{
+	if (sock->pool == nullptr)
+		sock->pool = pools[next_pool++ % pools.size()];
+	return *sock->pool;
 }
 
-inline void CheckPoolInvariant()
+inline void CheckPoolInvariant(Pool &pool)
 {
-	if (!*pool)
+	if (!pool)
 		AGSAbort("The AGS Sockets plug-in has experienced an "
 			"unrecoverable failure: pool invariant violated.");
 }
 
+inline void Socket_update_Local(Socket *);
+inline void Socket_update_Remote(Socket *);
+
+// Takes over the connection a pool raced for once it is made, or the reason
+// it was not. The script only sees the socket change when it looks, so the
+// pool never changes the socket from under it.
+inline void Adopt(Socket *sock)
+{
+	SOCKET id;
+	int family, error;
+	if (sock->connection != Socket::CONNECTING || sock->pool == nullptr
+		|| !sock->pool->claim(sock, id, family, error))
+		return;
+	
+	if (id != INVALID_SOCKET)
+	{
+		closesocket(sock->id);
+		sock->id = id;
+		sock->domain = family;
+		sock->connection = Socket::CONNECTED;
+		
+		// Addresses handed out before belong to the socket that was replaced
+		if (sock->local != nullptr)
+			Socket_update_Local(sock);
+		if (sock->remote != nullptr)
+			Socket_update_Remote(sock);
+		if (sock->pool->add(sock))
+		{
+			if (sock->unsent > 0)
+				sock->pool->flush(sock);
+			CheckPoolInvariant(*sock->pool);
+			return;
+		}
+		error = GET_ERROR();
+	}
+	
+	// Note: flushing a socket outside of the pool drops its data
+	sock->incoming.error = error;
+	sock->connection = Socket::FAILED;
+	sock->pool->flush(sock);
+	CheckPoolInvariant(*sock->pool);
+}
+
+// Accounts for received data the script is done with, which may leave room
+// for paused sockets to be read again. Only pools that paused any are locked.
+// Note: this is also called when nothing was read, so a socket that was paused
+//       just as its data was read is resumed the next time the script checks.
+inline void Consumed(size_t amount)
+{
+	Pool::unread -= amount;
+	if (Pool::paused > 0)
+		for (Pool *pool : pools)
+			pool->resume();
+}
+
 //==============================================================================
 
 int AGSSocket::Dispose(const char *ptr, bool force)
@@ -51,11 +144,16 @@ int AGSSocket::Dispose(const char *ptr, bool force)
 	if (sock->id != SOCKET_ERROR)
 	{
 		// Invalidate socket, forced close.
-		pool->remove(sock);
+		if (sock->pool != nullptr)
+			sock->pool->remove(sock);
 		closesocket(sock->id);
 		sock->id = SOCKET_ERROR;
 	}
 	
+	// Nobody is going to read what is left
+	Consumed(sock->incoming.size());
+	sockets.erase(sock);
+	
 	if (sock->local != nullptr)
 	{
 		AGS_RELEASE(sock->local);
@@ -132,6 +230,7 @@ void AGSSocket::Unserialize(int key, const char *buffer, int length)
 	};
 	
 	AGS_RESTORE(Socket, sock, key);
+	sockets.insert(sock);
 }
 
 //==============================================================================
@@ -144,7 +243,7 @@ Socket *Socket_Create(ags_t domain, ags_t type, ags_t protocol)
 
 	// The entire plugin is nonblocking except for:
 	//     1. connections in sync mode (async = false)
-	//     2. address lookups
+	//     2. address lookups, unless remembered or done by SockAddr.Lookup
 	setblocking(id, false);
 
 	Socket *sock = new Socket
@@ -155,6 +254,7 @@ Socket *Socket_Create(ags_t domain, ags_t type, ags_t protocol)
 		nullptr, nullptr
 	};
 	AGS_OBJECT(Socket, sock);
+	sockets.insert(sock);
 	
 	return sock;
 }
@@ -187,6 +287,102 @@ Socket *Socket_CreateTCPv6()
 	return Socket_Create(AF_INET6, SOCK_STREAM, IPPROTO_TCP);
 }
 
+//------------------------------------------------------------------------------
+
+void Socket_SetTotalReceiveLimit(ags_t limit)
+{
+	Pool::unread_limit = (limit > 0 ? (size_t) limit : 0);
+	Consumed(0);
+}
+
+//------------------------------------------------------------------------------
+// Sockets read by a pool have something to receive once their buffer does, or
+// are reported once when they finished connecting; the pools announce both
+// through a beacon. Listening sockets are not read by a pool, so they are
+// waited for along with that beacon.
+
+// Returns whether receiving from a socket that is not listening would return
+// something, or the error that ended it; with a delimiter set, only a whole
+// message counts.
+inline bool Receivable(Socket *sock)
+{
+	if (sock->incoming.error)
+		return true;
+	if (sock->delimiter.empty())
+		return !sock->incoming.empty();
+	return sock->incoming.complete(sock->delimiter);
+}
+
+// Returns one of the sockets that has something to receive or accept, or
+// finished connecting
+// \param timeout in milliseconds, negative to wait indefinitely
+Socket *WaitFor(Socket *const *socks, size_t count, ags_t timeout)
+{
+	using namespace std::chrono;
+	
+	auto deadline = steady_clock::now() + milliseconds(timeout);
+	static std::vector<SOCKET> waiting;
+	static std::vector<Socket *> listeners;
+	
+	for (bool last = false; ; )
+	{
+		// Reset first so data arriving while checking wakes us up right away
+		Pool::arrivals->reset();
+		waiting.assign(1, (SOCKET) *Pool::arrivals);
+		listeners.clear();
+		
+		for (size_t i = 0; i < count; ++i)
+		{
+			Socket *sock = socks[i];
+			if (sock->id == INVALID_SOCKET)
+				continue;
+			if (sock->listening)
+			{
+				waiting.push_back(sock->id);
+				listeners.push_back(sock);
+			}
+			else if (Receivable(sock))
+				return sock;
+			else if (sock->finished.exchange(false))
+			{
+				Adopt(sock);
+				return sock;
+			}
+		}
+		
+		// Arrivals for other sockets may keep waking us up past the deadline
+		if (last)
+			return nullptr;
+		long remaining = -1;
+		if (timeout >= 0)
+			remaining = (long) std::max<steady_clock::rep>(0,
+				duration_cast<milliseconds>(deadline - steady_clock::now()).count());
+		last = (remaining == 0);
+		
+		size_t ready = waitreadable(waiting.data(), waiting.size(), remaining);
+		if (ready == waiting.size())
+			return nullptr;
+		if (ready > 0)
+			return listeners[ready - 1];
+	}
+}
+
+//------------------------------------------------------------------------------
+
+Socket *Socket_WaitAny(ags_t timeout)
+{
+	static std::vector<Socket *> all;
+	static size_t next = 0;
+	
+	// A different socket goes first every time, so a busy one does not keep
+	// the others from being returned.
+	all.assign(sockets.begin(), sockets.end());
+	if (!all.empty())
+		std::rotate(all.begin(), all.begin() + next++ % all.size(), all.end());
+	
+	return WaitFor(all.data(), all.size(), timeout);
+}
+
 //==============================================================================
 
 ags_t Socket_get_Valid(Socket *sock)
@@ -210,6 +406,102 @@ void Socket_set_Tag(Socket *sock, const char *str)
 
 //------------------------------------------------------------------------------
 
+const char *Socket_get_Delimiter(Socket *sock)
+{
+	return AGS_STRING(sock->delimiter.c_str());
+}
+
+//------------------------------------------------------------------------------
+
+void Socket_set_Delimiter(Socket *sock, const char *str)
+{
+	sock->delimiter = str;
+}
+
+//------------------------------------------------------------------------------
+
+ags_t Socket_get_Unsent(Socket *sock)
+{
+	return (ags_t) sock->unsent;
+}
+
+//------------------------------------------------------------------------------
+
+ags_t Socket_get_SendLimit(Socket *sock)
+{
+	return (ags_t) sock->send_limit;
+}
+
+//------------------------------------------------------------------------------
+
+void Socket_set_SendLimit(Socket *sock, ags_t limit)
+{
+	sock->send_limit = (limit > 0 ? (size_t) limit : 0);
+}
+
+//------------------------------------------------------------------------------
+
+ags_t Socket_get_Unread(Socket *sock)
+{
+	return (ags_t) sock->incoming.size();
+}
+
+//------------------------------------------------------------------------------
+
+ags_t Socket_get_ReceiveLimit(Socket *sock)
+{
+	return (ags_t) sock->receive_limit;
+}
+
+//------------------------------------------------------------------------------
+
+void Socket_set_ReceiveLimit(Socket *sock, ags_t limit)
+{
+	sock->receive_limit = (limit > 0 ? (size_t) limit : 0);
+	// A raised limit may have room for data again
+	Consumed(0);
+}
+
+//------------------------------------------------------------------------------
+
+ags_t Socket_get_Dropped(Socket *sock)
+{
+	return (ags_t) sock->dropped;
+}
+
+//------------------------------------------------------------------------------
+
+ags_t Socket_get_Pending(Socket *sock)
+{
+	// Only listening sockets have to ask the system
+	Adopt(sock);
+	if (sock->id == INVALID_SOCKET)
+		return 0;
+	if (sock->listening)
+		return (waitreadable(&sock->id, 1, 0) == 0 ? 1 : 0);
+	return (Receivable(sock) ? 1 : 0);
+}
+
+//------------------------------------------------------------------------------
+
+ags_t Socket_get_Connected(Socket *sock)
+{
+	Adopt(sock);
+	return (sock->id != INVALID_SOCKET
+		&& sock->connection == Socket::CONNECTED ? 1 : 0);
+}
+
+//------------------------------------------------------------------------------
+
+ags_t Socket_get_Connecting(Socket *sock)
+{
+	Adopt(sock);
+	return (sock->id != INVALID_SOCKET
+		&& sock->connection == Socket::CONNECTING ? 1 : 0);
+}
+
+//------------------------------------------------------------------------------
+
 inline void Socket_update_Local(Socket *sock)
 {
 	ADDRLEN addrlen = sizeof (SockAddr);
@@ -280,8 +572,12 @@ ags_t Socket_Bind(Socket *sock, const SockAddr *addr)
 	// Faux connection UDP support
 	if (ret != SOCKET_ERROR && sock->protocol == IPPROTO_UDP)
 	{
-		pool->add(sock);
-		CheckPoolInvariant();
+		if (!PoolOf(sock).add(sock))
+		{
+			sock->error = GET_ERROR();
+			ret = SOCKET_ERROR;
+		}
+		CheckPoolInvariant(PoolOf(sock));
 	}
 	return ret == SOCKET_ERROR ? 0 : 1;
 }
@@ -294,6 +590,8 @@ ags_t Socket_Listen(Socket *sock, ags_t backlog)
 		backlog = SOMAXCONN;
 	int ret = listen(sock->id, backlog);
 	sock->error = GET_ERROR();
+	if (ret != SOCKET_ERROR)
+		sock->listening = true;
 	return ret == SOCKET_ERROR ? 0 : 1;
 }
 
@@ -302,8 +600,47 @@ ags_t Socket_Listen(Socket *sock, ags_t backlog)
 // by binding a remote address to the socket. We will complete this illusion by
 // adding the socket to the pool.
 
+// Connections in progress are finished by the pool, asking again merely tells
+// how far they got. Returns whether that is the case, along with the result.
+inline bool ConnectProgress(Socket *sock, ags_t &result)
+{
+	Adopt(sock);
+	result = 0;
+	
+	switch (sock->connection)
+	{
+		case Socket::CONNECTING:
+			sock->error = 0;
+			return true;
+		case Socket::FAILED:
+			// Reported once, after which connecting may be tried again
+			sock->connection = Socket::UNCONNECTED;
+			sock->error = sock->incoming.error;
+			sock->incoming.error = 0;
+			sock->finished = false;
+			return true;
+		case Socket::CONNECTED:
+			// Streams cannot connect elsewhere, datagrams change their target
+			if (sock->type == SOCK_STREAM && sock->id != INVALID_SOCKET)
+			{
+				sock->error = 0;
+				result = 1;
+				return true;
+			}
+			return false;
+		default:
+			return false;
+	}
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
 ags_t Socket_Connect(Socket *sock, const SockAddr *addr, ags_t async)
 {
+	ags_t result;
+	if (ConnectProgress(sock, result))
+		return result;
+	
 	int ret;
 	
 	if (!async) // Sync mode: do a blocking connect
@@ -315,22 +652,83 @@ ags_t Socket_Connect(Socket *sock, const SockAddr *addr, ags_t async)
 	else
 		ret = connect(sock->id, CONST_ADDR(addr), ADDR_SIZE(addr));
 	
-	// In async mode: returning false but with error == 0 is: try again
 	sock->error = GET_ERROR();
-	if (ALREADY(sock->error)) // If already trying to connect
+	
+	// In async mode the pool takes over, returning false with error == 0
+	if (ret == SOCKET_ERROR && async && ALREADY(sock->error))
+	{
 		sock->error = 0;
+		sock->connection = Socket::CONNECTING;
+		if (!PoolOf(sock).add(sock))
+		{
+			sock->connection = Socket::UNCONNECTED;
+			sock->error = GET_ERROR();
+		}
+		CheckPoolInvariant(PoolOf(sock));
+		return 0;
+	}
 	
 	if (ret != SOCKET_ERROR)
 	{
 		if (sock->remote != nullptr)
 			Socket_update_Remote(sock);
-		pool->add(sock);
-		CheckPoolInvariant();
+		sock->connection = Socket::CONNECTED;
+		if (!PoolOf(sock).add(sock))
+		{
+			sock->connection = Socket::UNCONNECTED;
+			sock->error = GET_ERROR();
+			ret = SOCKET_ERROR;
+		}
+		CheckPoolInvariant(PoolOf(sock));
 	}
 
 	return (ret == SOCKET_ERROR ? 0 : 1);
 }
 
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+ags_t Socket_ConnectByName(Socket *sock, const char *address)
+{
+	ags_t result;
+	if (ConnectProgress(sock, result))
+		return result;
+	
+	if (sock->id == INVALID_SOCKET)
+	{
+		SET_ERROR(NOTSOCK);
+		sock->error = GET_ERROR();
+		return 0;
+	}
+	
+	string node, service;
+	split_address(address, AF_UNSPEC, node, service);
+	
+	// Datagrams merely get a remote address, there is nothing to race for;
+	// the script tries again while the host is looked up in the background.
+	if (sock->type != SOCK_STREAM)
+	{
+		SockAddr addr;
+		Resolver::Status status = Resolver::request(node, service,
+			sock->domain, addr);
+		if (status == Resolver::FOUND)
+			return Socket_Connect(sock, &addr, 0);
+		if (status == Resolver::PENDING)
+		{
+			sock->error = 0;
+			return 0;
+		}
+		SET_ERROR(HOSTUNREACH);
+		sock->error = GET_ERROR();
+		return 0;
+	}
+	
+	// The socket is replaced by the connection that wins, see Adopt
+	sock->error = 0;
+	sock->connection = Socket::CONNECTING;
+	PoolOf(sock).race(sock, node, service);
+	return 0;
+}
+
 //------------------------------------------------------------------------------
 // Accept is nonblocking:
 // If it returns nullptr and the error is also 0: try again!
@@ -357,10 +755,25 @@ Socket *Socket_Accept(Socket *sock)
 		nullptr, nullptr
 	};
 	AGS_OBJECT(Socket, sock2);
+	sockets.insert(sock2);
+	sock2->connection = Socket::CONNECTED;
+	
+	// Connections are read like the socket that accepted them
+	sock2->read_minimum = (size_t) sock->read_minimum;
+	sock2->read_maximum = (size_t) sock->read_maximum;
+	sock2->linger = sock->linger;
 	
 	setblocking(conn, false);
-	pool->add(sock2);
-	CheckPoolInvariant();
+	if (!PoolOf(sock2).add(sock2))
+	{
+		// The connection cannot be served, so we refuse it; the unreferenced
+		// object will be disposed of by AGS.
+		sock->error = GET_ERROR();
+		closesocket(conn);
+		sock2->id = INVALID_SOCKET;
+		return nullptr;
+	}
+	CheckPoolInvariant(PoolOf(sock2));
 	
 	return sock2;
 }
@@ -369,53 +782,102 @@ Socket *Socket_Accept(Socket *sock)
 
 void Socket_Close(Socket *sock)
 {
-	if (sock->type == SOCK_STREAM)
+	// The pool takes over connections to close them gracefully: it sends
+	// what is queued, shuts down and waits for the remote host to do so too.
+	// Note: connections in progress are simply abandoned.
+	if (sock->type == SOCK_STREAM && sock->connection == Socket::CONNECTED
+		&& sock->linger > 0 && sock->pool != nullptr
+		&& sock->pool->retire(sock, sock->linger))
 	{
-		// Graceful shutdown, the poolthread will detect if it succeeded.
-		shutdown(sock->id, SD_SEND);
-		
-		// Wait for a response to prevent race conditions
-		fd_set read;
-		timeval timeout = {0, 500}; // Half a second fudge time
-		FD_ZERO(&read);
-		
-		FD_SET(sock->id, &read);
-		if (select(sock->id + 1, &read, nullptr, nullptr, &timeout) > 0)
-			return;
-			
-		// Select failed or timeout: we force close
+		sock->id = INVALID_SOCKET;
+		sock->error = 0;
+		sock->connection = Socket::UNCONNECTED;
+		CheckPoolInvariant(*sock->pool);
+		return;
 	}
 	
 	// Invalidate socket
-	pool->remove(sock);
+	if (sock->pool != nullptr)
+		sock->pool->remove(sock);
 	closesocket(sock->id);
 	sock->id = INVALID_SOCKET;
 	sock->error = GET_ERROR();
+	sock->connection = Socket::UNCONNECTED;
+}
+
+//------------------------------------------------------------------------------
+
+ags_t Socket_Wait(Socket *sock, ags_t timeout)
+{
+	return (WaitFor(&sock, 1, timeout) != nullptr ? 1 : 0);
 }
 
 //==============================================================================
 
 // Send is nonblocking:
 // If it returns 0 and the error is also 0: try again!
+// Stream data that does not fit is queued and sent by the pool; it is never
+// partially dropped, nor is more queued than the send limit allows.
 
 inline ags_t send_impl(Socket *sock, const char *buf, size_t count)
 {
+	Adopt(sock);
 	long ret = 0;
+	bool stream = (sock->type == SOCK_STREAM);
 	
-	while (count > 0)
+	// The system may take none of it, so whatever could be left unsent has to
+	// fit before any of it is sent; more than the limit never does.
+	if (stream && sock->send_limit && count > sock->send_limit)
 	{
-		ret = send(sock->id, buf, count, 0);
-		if (ret == SOCKET_ERROR)
-			break;
-		buf += ret;
-		count -= ret;
+		SET_ERROR(NOBUFS);
+		sock->error = GET_ERROR();
+		return 0;
 	}
 	
-	sock->error = GET_ERROR();
-	if (WOULD_BLOCK(sock->error))
+	// Queued data goes first to keep the stream in order, data sent while
+	// connecting is queued until the pool finished the connection
+	if (stream && (sock->unsent > 0 || sock->connection == Socket::CONNECTING))
+	{
+		if ((sock->error = sock->outgoing.error))
+			return 0;
+		
+		if (sock->send_limit && sock->unsent + count > sock->send_limit)
+			return 0;
+	}
+	else
+	{
+		while (count > 0)
+		{
+			ret = send(sock->id, buf, count, 0);
+			if (ret == SOCKET_ERROR)
+				break;
+			buf += ret;
+			count -= ret;
+		}
+		
+		sock->error = GET_ERROR();
+		if (ret == SOCKET_ERROR && !WOULD_BLOCK(sock->error))
+			return 0;
 		sock->error = 0;
-
-	return (ret == SOCKET_ERROR ? 0 : 1);
+		
+		// Packets are sent whole or not at all
+		if (!stream)
+			return (ret == SOCKET_ERROR ? 0 : 1);
+	}
+	
+	if (count > 0)
+	{
+		// Counted first so the pool never sees more data than is counted
+		sock->unsent += count;
+		sock->outgoing.push(buf, count);
+		if (!PoolOf(sock).flush(sock))
+		{
+			sock->error = GET_ERROR();
+			return 0;
+		}
+	}
+	
+	return 1;
 }
 
 ags_t Socket_Send(Socket *sock, const char *str)
@@ -430,6 +892,22 @@ ags_t Socket_SendData(Socket *sock, const SockData *data)
 
 //------------------------------------------------------------------------------
 
+// A datagram socket that was not bound is bound by the system as soon as it
+// sends, after which replies may arrive; the pool reads those from then on.
+// Returns false if the pool did not take it, with the reason as last error.
+
+inline bool Enlist(Socket *sock)
+{
+	if (sock->pool != nullptr || sock->id == INVALID_SOCKET)
+		return true;
+	
+	bool added = PoolOf(sock).add(sock);
+	CheckPoolInvariant(PoolOf(sock));
+	return added;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
 inline ags_t sendto_impl(Socket *sock, const SockAddr *addr,
 	const char *buf, size_t count)
 {
@@ -448,7 +926,11 @@ inline ags_t sendto_impl(Socket *sock, const SockAddr *addr,
 	if (WOULD_BLOCK(sock->error))
 		sock->error = 0;
 	
-	return (ret == SOCKET_ERROR ? 0 : 1);
+	// Note: should the pool not take it, receiving tries again and reports why
+	if (ret == SOCKET_ERROR)
+		return 0;
+	Enlist(sock);
+	return 1;
 }
 
 ags_t Socket_SendTo(Socket *sock, const SockAddr *addr, const char *str)
@@ -463,19 +945,125 @@ ags_t Socket_SendDataTo(Socket *sock, const SockAddr *addr, const SockData *data
 
 //------------------------------------------------------------------------------
 
-// Receives and removes a chunk of data from a buffer and returns it
+// Only datagrams are queued, a stream has no use for a destination per message
+
+inline bool queue_check(Socket *sock)
+{
+	if (sock->type == SOCK_DGRAM)
+		return true;
+	
+	SET_ERROR(OPNOTSUPP);
+	sock->error = GET_ERROR();
+	return false;
+}
+
+void Socket_QueueTo(Socket *sock, const SockAddr *addr, const char *str)
+{
+	if (queue_check(sock))
+		sock->queued.push_back(Datagram {*addr, str});
+}
+
+void Socket_QueueDataTo(Socket *sock, const SockAddr *addr, const SockData *data)
+{
+	if (queue_check(sock))
+		sock->queued.push_back(Datagram {*addr, data->data});
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+// Every datagram is tried, even after some failed; their errors are kept so the
+// caller can tell which ones to send again.
+
+ags_t Socket_SendQueued(Socket *sock)
+{
+	size_t count = sock->queued.size();
+	sock->results.assign(count, 0);
+	
+#ifdef HAVE_SENDMMSG
+	// The datagrams are handed over in as few system calls as possible
+	std::vector<iovec> buffers(count);
+	std::vector<mmsghdr> msgs(count);
+	for (size_t i = 0; i < count; ++i)
+	{
+		Datagram &datagram = sock->queued[i];
+		buffers[i].iov_base = &datagram.data[0];
+		buffers[i].iov_len = datagram.data.size();
+		msgs[i].msg_hdr = {};
+		msgs[i].msg_hdr.msg_name = &datagram.target;
+		msgs[i].msg_hdr.msg_namelen = ADDR_SIZE(&datagram.target);
+		msgs[i].msg_hdr.msg_iov = &buffers[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	
+	for (size_t i = 0; i < count; )
+	{
+		// The datagram a batch stopped at is the one that failed
+		int ret = sendmmsg(sock->id, &msgs[i], count - i, 0);
+		if (ret == SOCKET_ERROR)
+			sock->results[i++] = GET_ERROR();
+		else
+			i += ret;
+	}
+#else
+	for (size_t i = 0; i < count; ++i)
+	{
+		Datagram &datagram = sock->queued[i];
+		if (sendto(sock->id, datagram.data.data(), datagram.data.size(), 0,
+			CONST_ADDR(&datagram.target), ADDR_SIZE(&datagram.target))
+			== SOCKET_ERROR)
+			sock->results[i] = GET_ERROR();
+	}
+#endif
+	sock->queued.clear();
+	
+	// The socket reports the first error, like separate sends would
+	ags_t sent = 0;
+	sock->error = 0;
+	for (int error : sock->results)
+		if (!error)
+			++sent;
+		else if (!sock->error && !WOULD_BLOCK(error))
+			sock->error = error;
+	if (sent > 0)
+		Enlist(sock);
+	return sent;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+ags_t Socket_QueuedError(Socket *sock, ags_t index)
+{
+	if (index < 0 || (size_t) index >= sock->results.size())
+		return AGSSOCK_NO_ERROR;
+	return AGSEnumerateError(sock->results[index]);
+}
+
+//------------------------------------------------------------------------------
+
+// Receives and removes a chunk of data from a socket buffer and returns it
 // Comes in a AGS String and SockData flavour
-template <typename T> inline T *recv_extract(Buffer &buffer, bool stream);
+// Returns null if no complete chunk was received yet
+template <typename T> inline T *recv_extract(Socket *sock);
 
-template <> inline const char *recv_extract(Buffer &buffer, bool stream)
+template <> inline const char *recv_extract(Socket *sock)
 {
+	Buffer &buffer = sock->incoming;
+
+	// With a delimiter set, messages are framed by it instead
+	if (!sock->delimiter.empty())
+	{
+		string message;
+		if (!buffer.extract(sock->delimiter, message))
+			return nullptr;
+		return AGS_STRING(message.c_str());
+	}
+
 	// Get a truncated (zero terminated) version of the received data.
-	const char *data = AGS_STRING(buffer.front().c_str());
+	const char *data = AGS_STRING(buffer.message());
 
 	// If the connection is streaming we clear the buffer till the first
 	// zero-character; otherwise we are dealing with packets: we remove the
 	// current packet from the buffer.
-	if (stream)
+	if (sock->type == SOCK_STREAM)
 		buffer.extract();
 	else
 		buffer.pop();
@@ -483,14 +1071,14 @@ template <> inline const char *recv_extract(Buffer &buffer, bool stream)
 	return data;
 }
 
-template <> inline SockData *recv_extract(Buffer &buffer, bool stream)
+template <> inline SockData *recv_extract(Socket *sock)
 {
 	// For SockData output, we don't have to worry about zero-characters,
 	// thus we receive everything and then clear the buffer.
 	SockData *data = new SockData();
 	AGS_OBJECT(SockData, data);
-	data->data.swap(buffer.front());
-	buffer.pop();
+	data->data.swap(sock->incoming.front());
+	sock->incoming.pop();
 	return data;
 }
 
@@ -512,46 +1100,54 @@ template <> inline bool recv_empty(SockData *data)
 
 //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
 
-template <typename T> inline T *recv_impl(Socket *sock)
+template <typename T> inline T *recv_take(Socket *sock)
 {
-	T *data;
+	// The error is checked first so all data received before it is seen
+	int error = sock->incoming.error;
 	
+	if (sock->incoming.empty())
 	{
-		Mutex::Lock lock(*pool);
-	
-		if (sock->incoming.empty())
+		// Read buffer is empty: either nothing or an error occurred.
+		// In both cases we return null, the error code will tell.
+		sock->error = error;
+		
+		if (sock->error)
 		{
-			// Read buffer is empty: either nothing or an error occurred.
-			// In both cases we return null, the error code will tell.
-			sock->error = sock->incoming.error;
-			
-			if (sock->error)
-			{
-				// Invalidate socket in case of error
-				closesocket(sock->id);
-				sock->id = INVALID_SOCKET;
-				// The read loop itself will remove it from the pool
-			}
-			
-			return nullptr;
+			// Invalidate socket in case of error
+			closesocket(sock->id);
+			sock->id = INVALID_SOCKET;
+			// The read loop already removed it from the pool
 		}
 		
-		data = recv_extract<T>(sock->incoming, sock->type == SOCK_STREAM);
+		return nullptr;
 	}
 	
+	T *data = recv_extract<T>(sock);
 	sock->error = 0;
+	
+	if (data == nullptr) // Only part of a message was received
+		return nullptr;
 
 	if (recv_empty(data) && sock->type == SOCK_STREAM)
 	{
 		// TCP socket was closed, invalidate it.
 		closesocket(sock->id);
 		sock->id = INVALID_SOCKET;
-		// The read loop itself will remove it from the pool
+		// The read loop already removed it from the pool
 	}
 	
 	return data;
 }
 
+template <typename T> inline T *recv_impl(Socket *sock)
+{
+	Adopt(sock);
+	size_t removed = sock->incoming.removed();
+	T *data = recv_take<T>(sock);
+	Consumed(sock->incoming.removed() - removed);
+	return data;
+}
+
 const char *Socket_Recv(Socket *sock)
 {
 	// An empty string indicates 'end of stream' but an input starting with a
@@ -569,37 +1165,35 @@ SockData *Socket_RecvData(Socket *sock)
 
 //------------------------------------------------------------------------------
 
-template <typename T> inline T *recvfrom_return(const char *buf, size_t count);
-
-template <> inline const char *recvfrom_return(const char *buf, size_t count)
-{
-	return AGS_STRING(buf);
-}
-
-template <> inline SockData *recvfrom_return(const char *buf, size_t count)
-{
-	SockData *data = new SockData();
-	AGS_OBJECT(SockData, data);
-	data->data = string(buf, count);
-	return data;
-}
-
-//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+// Datagrams are received by the pool along with their sender, so this is
+// merely a matter of taking them from the buffer.
 
 template <typename T> inline T *recvfrom_impl(Socket *sock, SockAddr *addr)
 {
-	char buffer[65536];
-	buffer[sizeof (buffer) - 1] = 0;
-
-	ADDRLEN addrlen = sizeof (SockAddr);
-	long ret = recvfrom(sock->id, buffer, sizeof (buffer) - 1, 0,
-		ADDR(addr), &addrlen);
-	sock->error = GET_ERROR();
-	
-	if (ret == SOCKET_ERROR)
+	// Sockets that were neither bound nor sent from receive nothing yet
+	if (!Enlist(sock))
+	{
+		sock->error = GET_ERROR();
 		return nullptr;
+	}
+	
+	// The sender is copied before its datagram is removed
+	if (!sock->incoming.empty())
+	{
+		const SOCKADDR_STORAGE *source = sock->incoming.source();
+		if (source != nullptr)
+			*static_cast<SOCKADDR_STORAGE *> (addr) = *source;
+	}
+	
+	T *data = recv_impl<T>(sock);
 	
-	return recvfrom_return<T>(buffer, ret);
+	// Like recvfrom, having nothing to receive is reported as such
+	if (data == nullptr && sock->error == 0)
+	{
+		SET_ERROR(WOULDBLOCK);
+		sock->error = GET_ERROR();
+	}
+	return data;
 }
 
 const char *Socket_RecvFrom(Socket *sock, SockAddr *addr)
@@ -614,17 +1208,130 @@ SockData *Socket_RecvDataFrom(Socket *sock, SockAddr *addr)
 
 //==============================================================================
 
-// Unimplemented, there is probably no use for this
+// Options the plugin names portably, as the system calls them differently
+// Note: all of these take an int value, so they all pass for the same.
+struct SystemOption
+{
+	ags_t option;
+	int level, name;
+};
 
-ags_t Socket_GetOption(Socket *, ags_t level, ags_t option)
+const SystemOption system_options[] =
 {
-	return 0;
+	{AGSSOCK_NO_DELAY,       IPPROTO_TCP, TCP_NODELAY},
+	{AGSSOCK_RECEIVE_BUFFER, SOL_SOCKET,  SO_RCVBUF},
+	{AGSSOCK_SEND_BUFFER,    SOL_SOCKET,  SO_SNDBUF},
+	{AGSSOCK_KEEP_ALIVE,     SOL_SOCKET,  SO_KEEPALIVE},
+	{AGSSOCK_BROADCAST,      SOL_SOCKET,  SO_BROADCAST},
+	{AGSSOCK_REUSE_ADDRESS,  SOL_SOCKET,  SO_REUSEADDR},
+#ifdef SO_REUSEPORT
+	{AGSSOCK_REUSE_PORT,     SOL_SOCKET,  SO_REUSEPORT},
+#endif
+};
+
+// Finds the system level and name of a plugin option; any other level is
+// taken to be one of the system already.
+inline bool SystemOptionOf(ags_t level, ags_t option, int &sys_level,
+	int &sys_name)
+{
+	sys_level = (int) level;
+	sys_name = (int) option;
+	if (level != AGSSOCK_LEVEL)
+		return true;
+
+	for (const SystemOption &entry : system_options)
+		if (entry.option == option)
+		{
+			sys_level = entry.level;
+			sys_name = entry.name;
+			return true;
+		}
+
+	// Options not supported on this platform end up here as well
+	SET_ERROR(NOPROTOOPT);
+	return false;
 }
 
 //------------------------------------------------------------------------------
 
-void Socket_SetOption(Socket *, ags_t level, ags_t option, ags_t value)
+ags_t Socket_GetOption(Socket *sock, ags_t level, ags_t option)
 {
+	sock->error = 0;
+
+	// The read bounds and linger time are no system options
+	if (level == AGSSOCK_LEVEL && option == AGSSOCK_READ_MINIMUM)
+		return (ags_t) sock->read_minimum;
+	if (level == AGSSOCK_LEVEL && option == AGSSOCK_READ_MAXIMUM)
+		return (ags_t) sock->read_maximum;
+	if (level == AGSSOCK_LEVEL && option == AGSSOCK_LINGER)
+		return (ags_t) sock->linger;
+
+	int sys_level, sys_name, value = 0;
+	ADDRLEN length = sizeof (value);
+	if (!SystemOptionOf(level, option, sys_level, sys_name)
+		|| getsockopt(sock->id, sys_level, sys_name,
+			reinterpret_cast<char *> (&value), &length))
+	{
+		sock->error = GET_ERROR();
+		return 0;
+	}
+
+	return (ags_t) value;
+}
+
+//------------------------------------------------------------------------------
+
+ags_t Socket_SetOption(Socket *sock, ags_t level, ags_t option, ags_t value)
+{
+	sock->error = 0;
+
+	// The pool picks up new read bounds the next time it reads
+	// Note: the minimum may not exceed the maximum, so both can be set in
+	//       either order as long as the range stays valid.
+	if (level == AGSSOCK_LEVEL && option == AGSSOCK_READ_MINIMUM)
+	{
+		if (value > 0 && (size_t) value <= sock->read_maximum)
+		{
+			sock->read_minimum = (size_t) value;
+			return 1;
+		}
+		SET_ERROR(INVAL);
+		sock->error = GET_ERROR();
+		return 0;
+	}
+	if (level == AGSSOCK_LEVEL && option == AGSSOCK_READ_MAXIMUM)
+	{
+		if (value > 0 && (size_t) value >= sock->read_minimum)
+		{
+			sock->read_maximum = (size_t) value;
+			return 1;
+		}
+		SET_ERROR(INVAL);
+		sock->error = GET_ERROR();
+		return 0;
+	}
+	if (level == AGSSOCK_LEVEL && option == AGSSOCK_LINGER)
+	{
+		if (value >= 0)
+		{
+			sock->linger = (long) value;
+			return 1;
+		}
+		SET_ERROR(INVAL);
+		sock->error = GET_ERROR();
+		return 0;
+	}
+
+	int sys_level, sys_name, sys_value = (int) value;
+	if (!SystemOptionOf(level, option, sys_level, sys_name)
+		|| setsockopt(sock->id, sys_level, sys_name,
+			reinterpret_cast<const char *> (&sys_value), sizeof (sys_value)))
+	{
+		sock->error = GET_ERROR();
+		return 0;
+	}
+
+	return 1;
 }
 
 //------------------------------------------------------------------------------
@@ -12,7 +12,9 @@
 #ifndef _SOCKET_H
 #define _SOCKET_H
 
+#include <atomic>
 #include <string>
+#include <vector>
 
 #include "API.h"
 #include "Buffer.h"
@@ -20,19 +22,89 @@
 #include "SockData.h"
 #include "version.h"
 
+#ifndef POOL_SHARDS
+	#define POOL_SHARDS 0
+#endif
+
+// Whether the read threads run from Initialize to Terminate, rather than only
+// while there are sockets to read
+#ifndef POOL_PERSISTENT
+	#define POOL_PERSISTENT 1
+#endif
+
+// Amount of received data all sockets together may hold, unlimited if zero
+#ifndef RECEIVE_LIMIT
+	#define RECEIVE_LIMIT (64 << 20)
+#endif
+
+// Bounds of the amount the pool reads from a stream socket at once; within
+// these it adapts to the traffic of each socket.
+#ifndef READ_MINIMUM
+	#define READ_MINIMUM 4096
+#endif
+#ifndef READ_MAXIMUM
+	#define READ_MAXIMUM (128 << 10)
+#endif
+
+// Milliseconds a connection attempt is given before the next address of the
+// host is tried alongside it (RFC 8305)
+#ifndef CONNECT_DELAY
+	#define CONNECT_DELAY 250
+#endif
+
+// Milliseconds the pool waits for the remote host to close a connection that
+// was closed, before it gives up on it
+#ifndef CLOSE_LINGER
+	#define CLOSE_LINGER 5000
+#endif
+
+// Options named by the plugin, either its own or common ones of the system
+#define AGSSOCK_LEVEL         -1
+#define AGSSOCK_READ_MINIMUM   1
+#define AGSSOCK_READ_MAXIMUM   2
+#define AGSSOCK_NO_DELAY       3
+#define AGSSOCK_RECEIVE_BUFFER 4
+#define AGSSOCK_SEND_BUFFER    5
+#define AGSSOCK_KEEP_ALIVE     6
+#define AGSSOCK_BROADCAST      7
+#define AGSSOCK_REUSE_ADDRESS  8
+#define AGSSOCK_REUSE_PORT     9
+#define AGSSOCK_LINGER        10
+
 //! A BSD sockets wrapper plugin for AGS
 //! \warning Assumes the API has successfully been initialized.
 namespace AGSSock {
 
 //------------------------------------------------------------------------------
 
-void Initialize(); //!< Initializes the interface so it is ready to be used
-void Terminate();  //!< Resets the interface to its initial state
+//! Initializes the interface so it is ready to be used
+//! \param shards the number of pools (and read threads) sockets are spread
+//! over; zero means one for each processor core.
+void Initialize(unsigned int shards = POOL_SHARDS);
+void Terminate(); //!< Resets the interface to its initial state
 
 //------------------------------------------------------------------------------
 
+class Pool;
+
+//! A datagram waiting to be sent in a batch
+struct Datagram
+{
+	SockAddr target;
+	Bytes data;
+};
+
 struct Socket
 {
+	//! How far a connection got
+	enum Connection
+	{
+		UNCONNECTED, //!< Not connected, or the connection was lost
+		CONNECTING,  //!< The pool finishes the connection in the background
+		CONNECTED,   //!< The connection is established
+		FAILED       //!< The connection could not be made, see incoming.error
+	};
+	
 	// Exposed: <<<DO NOT CHANGE THE ORDER!!!>>>
 	SOCKET id;
 	int domain, type, protocol;
@@ -41,7 +113,23 @@ struct Socket
 	// Internal:
 	SockAddr *local, *remote;
 	std::string tag;
-	Buffer incoming; // This design does not feature an outgoing buffer
+	std::string delimiter; // Frames received strings; zero-character if empty
+	Buffer incoming;
+	Buffer outgoing; // Stream data that could not be sent right away
+	std::atomic<size_t> unsent; // Amount of outgoing data, counted when queued
+	size_t send_limit; // Amount that may be left unsent; unlimited if zero
+	std::atomic<size_t> receive_limit; // Amount of unread data at which the pool stops reading; unlimited if zero
+	std::atomic<size_t> dropped; // Datagrams dropped as the limit was reached
+	std::atomic<size_t> read_minimum {READ_MINIMUM}; // Least amount the pool reads at once
+	std::atomic<size_t> read_maximum {READ_MAXIMUM}; // Most amount the pool reads at once
+	size_t read_size {0}; // Amount the pool reads next, only used by the pool
+	long linger {CLOSE_LINGER}; // Milliseconds the pool lingers on a closed connection; none if zero
+	std::vector<Datagram> queued; // Datagrams to send in a single batch
+	std::vector<int> results; // Error codes of the last batch sent
+	Pool *pool;      // The pool shard serving this socket, once assigned
+	bool listening;  // Whether connections are accepted rather than data read
+	std::atomic<Connection> connection {UNCONNECTED}; // Kept up to date by the pool once registered
+	std::atomic<bool> finished {false}; // Whether Wait has yet to report that connecting finished
 };
 
 AGS_DEFINE_CLASS(Socket)
@@ -54,9 +142,24 @@ Socket *Socket_CreateTCP();
 Socket *Socket_CreateUDPv6();
 Socket *Socket_CreateTCPv6();
 
+void Socket_SetTotalReceiveLimit(ags_t);
+Socket *Socket_WaitAny(ags_t timeout);
+
 ags_t Socket_get_Valid(Socket *);
 const char *Socket_get_Tag(Socket *);
 void Socket_set_Tag(Socket *, const char *);
+const char *Socket_get_Delimiter(Socket *);
+void Socket_set_Delimiter(Socket *, const char *);
+ags_t Socket_get_Unsent(Socket *);
+ags_t Socket_get_SendLimit(Socket *);
+void Socket_set_SendLimit(Socket *, ags_t);
+ags_t Socket_get_Unread(Socket *);
+ags_t Socket_get_ReceiveLimit(Socket *);
+void Socket_set_ReceiveLimit(Socket *, ags_t);
+ags_t Socket_get_Dropped(Socket *);
+ags_t Socket_get_Pending(Socket *);
+ags_t Socket_get_Connected(Socket *);
+ags_t Socket_get_Connecting(Socket *);
 SockAddr *Socket_get_Local(Socket *);
 SockAddr *Socket_get_Remote(Socket *);
 ags_t Socket_ErrorValue(Socket *sock);
@@ -65,20 +168,26 @@ const char *Socket_ErrorString(Socket *);
 ags_t Socket_Bind(Socket *, const SockAddr *);
 ags_t Socket_Listen(Socket *, ags_t backlog);
 ags_t Socket_Connect(Socket *, const SockAddr *, ags_t async);
+ags_t Socket_ConnectByName(Socket *, const char *address);
 Socket *Socket_Accept(Socket *);
 void Socket_Close(Socket *);
+ags_t Socket_Wait(Socket *, ags_t timeout);
 
 ags_t Socket_Send(Socket *, const char *);
 ags_t Socket_SendData(Socket *, const SockData *);
 ags_t Socket_SendTo(Socket *, const SockAddr *, const char *);
 ags_t Socket_SendDataTo(Socket *, const SockAddr *, const SockData *);
+void Socket_QueueTo(Socket *, const SockAddr *, const char *);
+void Socket_QueueDataTo(Socket *, const SockAddr *, const SockData *);
+ags_t Socket_SendQueued(Socket *);
+ags_t Socket_QueuedError(Socket *, ags_t index);
 const char *Socket_Recv(Socket *);
 SockData *Socket_RecvData(Socket *);
 const char *Socket_RecvFrom(Socket *, SockAddr *);
 SockData *Socket_RecvDataFrom(Socket *, SockAddr *);
 
 ags_t Socket_GetOption(Socket *, ags_t level, ags_t option);
-void Socket_SetOption(Socket *, ags_t level, ags_t option, ags_t value);
+ags_t Socket_SetOption(Socket *, ags_t level, ags_t option, ags_t value);
 
 //------------------------------------------------------------------------------
 
@@ -104,6 +213,23 @@ void Socket_SetOption(Socket *, ags_t level, ags_t option, ags_t value);
 	"	eSockNetworkNotAvailable = " STRINGIFY(AGSSOCK_NETWORK_NOT_AVAILABLE) ",\r\n" \
 	"	eSockNotConnected        = " STRINGIFY(AGSSOCK_NOT_CONNECTED) "\r\n" \
 	"};\r\n\r\n" \
+	"enum SockOptionLevel\r\n" \
+	"{\r\n" \
+	"	eSockLevelPlugin         = " STRINGIFY(AGSSOCK_LEVEL) "\r\n" \
+	"};\r\n\r\n" \
+	"enum SockOption\r\n" \
+	"{\r\n" \
+	"	eSockOptReadMinimum      = " STRINGIFY(AGSSOCK_READ_MINIMUM) ",\r\n" \
+	"	eSockOptReadMaximum      = " STRINGIFY(AGSSOCK_READ_MAXIMUM) ",\r\n" \
+	"	eSockOptNoDelay          = " STRINGIFY(AGSSOCK_NO_DELAY) ",\r\n" \
+	"	eSockOptReceiveBuffer    = " STRINGIFY(AGSSOCK_RECEIVE_BUFFER) ",\r\n" \
+	"	eSockOptSendBuffer       = " STRINGIFY(AGSSOCK_SEND_BUFFER) ",\r\n" \
+	"	eSockOptKeepAlive        = " STRINGIFY(AGSSOCK_KEEP_ALIVE) ",\r\n" \
+	"	eSockOptBroadcast        = " STRINGIFY(AGSSOCK_BROADCAST) ",\r\n" \
+	"	eSockOptReuseAddress     = " STRINGIFY(AGSSOCK_REUSE_ADDRESS) ",\r\n" \
+	"	eSockOptReusePort        = " STRINGIFY(AGSSOCK_REUSE_PORT) ",\r\n" \
+	"	eSockOptLinger           = " STRINGIFY(AGSSOCK_LINGER) "\r\n" \
+	"};\r\n\r\n" \
 	"managed struct Socket\r\n" \
 	"{\r\n" \
 	"	/// Creates a socket for the specified protocol. (advanced)\r\n" \
@@ -116,6 +242,10 @@ void Socket_SetOption(Socket *, ags_t level, ags_t option, ags_t value);
 	"	import static Socket *CreateUDPv6();         // $AUTOCOMPLETESTATICONLY$\r\n" \
 	"	/// Creates a TCP socket for IPv6. (when in doubt use CreateTCP)\r\n" \
 	"	import static Socket *CreateTCPv6();         // $AUTOCOMPLETESTATICONLY$\r\n" \
+	"	/// Sets the amount of unread bytes all sockets together may hold before receiving stops. (0 for no limit)\r\n" \
+	"	import static void SetTotalReceiveLimit(int limit); // $AUTOCOMPLETESTATICONLY$\r\n" \
+	"	/// Waits until any socket has something to receive or accept, or finished connecting, for at most the given milliseconds. Returns that socket, or null if none.\r\n" \
+	"	import static Socket *WaitAny(int timeout = 0); // $AUTOCOMPLETESTATICONLY$\r\n" \
 	"	\r\n" \
 	"	readonly int ID;                             // $AUTOCOMPLETEIGNORE$\r\n" \
 	"	readonly int Domain;                         // $AUTOCOMPLETEIGNORE$\r\n" \
@@ -124,6 +254,24 @@ void Socket_SetOption(Socket *, ags_t level, ags_t option, ags_t value);
 	"	readonly int LastError;\r\n" \
 	"	\r\n" \
 	"	         import attribute String Tag;\r\n" \
+	"	/// Separates the strings Recv returns. (when empty: a zero-character)\r\n" \
+	"	         import attribute String Delimiter;\r\n" \
+	"	/// Amount of bytes Send left for the plugin to send in the background.\r\n" \
+	"	readonly import attribute int Unsent;\r\n" \
+	"	/// Amount of bytes that may be left unsent before Send asks to try again. (0 for no limit)\r\n" \
+	"	         import attribute int SendLimit;\r\n" \
+	"	/// Amount of bytes received that have yet to be read.\r\n" \
+	"	readonly import attribute int Unread;\r\n" \
+	"	/// Amount of unread bytes at which receiving stops until they are read. (0 for no limit)\r\n" \
+	"	         import attribute int ReceiveLimit;\r\n" \
+	"	/// Amount of messages dropped because the receive limit was reached. (UDP only)\r\n" \
+	"	readonly import attribute int Dropped;\r\n" \
+	"	/// Whether there is something to receive or accept, so Recv or Accept will not have to try again later.\r\n" \
+	"	readonly import attribute bool Pending;\r\n" \
+	"	/// Whether the socket is connected to a remote host. (for UDP: whether it has a remote address)\r\n" \
+	"	readonly import attribute bool Connected;\r\n" \
+	"	/// Whether an asynchronous Connect is still being made in the background.\r\n" \
+	"	readonly import attribute bool Connecting;\r\n" \
 	"	readonly import attribute SockAddr *Local;\r\n" \
 	"	readonly import attribute SockAddr *Remote;\r\n" \
 	"	readonly import attribute bool Valid;\r\n" \
@@ -136,12 +284,16 @@ void Socket_SetOption(Socket *, ags_t level, ags_t option, ags_t value);
 	"	import bool Bind(SockAddr *local);\r\n" \
 	"	/// Makes a socket listen for incoming connection requests. (TCP only) Backlog specifies how many requests can be queued. (optional)\r\n" \
 	"	import bool Listen(int backlog = 10);\r\n" \
-	"	/// Makes a socket connect to a remote host. (for UDP it will simply bind to a remote address) Defaults to sync which makes it wait; see the manual for async use.\r\n" \
+	"	/// Makes a socket connect to a remote host. (for UDP it will simply bind to a remote address) Defaults to sync which makes it wait; when async it returns right away and Connecting tells when it is done.\r\n" \
 	"	import bool Connect(SockAddr *host, bool async = false);\r\n" \
+	"	/// Makes a socket connect to a host by name, like \"example.com:80\", trying all its addresses. Always async; see Connect. (UDP: try again while no error)\r\n" \
+	"	import bool ConnectByName(const string address);\r\n" \
 	"	/// Accepts a connection request and returns the resulting socket when successful. (TCP only)\r\n" \
 	"	import Socket *Accept();\r\n" \
-	"	/// Closes the socket. (you can still receive until socket is marked invalid)\r\n" \
+	"	/// Closes the socket right away; the plugin finishes sending and waits for the remote host to close in the background. (you can still receive what arrived before)\r\n" \
 	"	import void Close();\r\n" \
+	"	/// Waits until there is something to receive or accept, or connecting finished, for at most the given milliseconds. Returns whether so.\r\n" \
+	"	import bool Wait(int timeout);\r\n" \
 	"	\r\n" \
 	"	/// Sends a string to the remote host. Returns whether successful. (no error means: try again later)\r\n" \
 	"	import bool Send(const string msg);\r\n" \
@@ -161,10 +313,19 @@ void Socket_SetOption(Socket *, ags_t level, ags_t option, ags_t value);
 	"	/// Receives raw data from an unspecified host. The given address object will contain the remote address. (UDP only)\r\n" \
 	"	import SockData *RecvDataFrom(SockAddr *source);\r\n" \
 	"	\r\n" \
-	"	/// Gets a socket option. (advanced)\r\n" \
-	"	import long GetOption(int level, int option);             // $AUTOCOMPLETEIGNORE$\r\n" \
-	"	/// Sets a socket option. (advanced)\r\n" \
-	"	import bool SetOption(int level, int option, long value); // $AUTOCOMPLETEIGNORE$\r\n" \
+	"	/// Queues a string to be sent to the specified remote host by SendQueued. (UDP only)\r\n" \
+	"	import void QueueTo(SockAddr *target, const string msg);\r\n" \
+	"	/// Queues raw data to be sent to the specified remote host by SendQueued. (UDP only)\r\n" \
+	"	import void QueueDataTo(SockAddr *target, SockData *data);\r\n" \
+	"	/// Sends everything queued at once. Returns how many were sent; QueuedError tells why others were not.\r\n" \
+	"	import int SendQueued();\r\n" \
+	"	/// Returns the error for one of the messages the last SendQueued call tried to send, counting from 0 in the order they were queued.\r\n" \
+	"	import SockError QueuedError(int index);\r\n" \
+	"	\r\n" \
+	"	/// Gets a socket option. (level eSockLevelPlugin for the SockOption values)\r\n" \
+	"	import long GetOption(int level, int option);\r\n" \
+	"	/// Sets a socket option. Returns whether successful. (level eSockLevelPlugin for the SockOption values)\r\n" \
+	"	import bool SetOption(int level, int option, long value);\r\n" \
 	"};\r\n"
 
 #define SOCKET_ENTRY    	                     \
@@ -174,7 +335,18 @@ void Socket_SetOption(Socket *, ags_t level, ags_t option, ags_t value);
 	AGS_METHOD  (Socket, CreateTCP, 0)           \
 	AGS_METHOD  (Socket, CreateUDPv6, 0)         \
 	AGS_METHOD  (Socket, CreateTCPv6, 0)         \
+	AGS_METHOD  (Socket, SetTotalReceiveLimit, 1) \
+	AGS_METHOD  (Socket, WaitAny, 1)             \
 	AGS_MEMBER  (Socket, Tag)                    \
+	AGS_MEMBER  (Socket, Delimiter)              \
+	AGS_READONLY(Socket, Unsent)                 \
+	AGS_MEMBER  (Socket, SendLimit)              \
+	AGS_READONLY(Socket, Unread)                 \
+	AGS_MEMBER  (Socket, ReceiveLimit)           \
+	AGS_READONLY(Socket, Dropped)                \
+	AGS_READONLY(Socket, Pending)                \
+	AGS_READONLY(Socket, Connected)              \
+	AGS_READONLY(Socket, Connecting)             \
 	AGS_READONLY(Socket, Local)                  \
 	AGS_READONLY(Socket, Remote)                 \
 	AGS_READONLY(Socket, Valid)                  \
@@ -183,8 +355,10 @@ void Socket_SetOption(Socket *, ags_t level, ags_t option, ags_t value);
 	AGS_METHOD  (Socket, Bind, 1)                \
 	AGS_METHOD  (Socket, Listen, 1)              \
 	AGS_METHOD  (Socket, Connect, 2)             \
+	AGS_METHOD  (Socket, ConnectByName, 1)       \
 	AGS_METHOD  (Socket, Accept, 0)              \
 	AGS_METHOD  (Socket, Close, 0)               \
+	AGS_METHOD  (Socket, Wait, 1)                \
 	AGS_METHOD  (Socket, Send, 1)                \
 	AGS_METHOD  (Socket, SendTo, 2)              \
 	AGS_METHOD  (Socket, Recv, 0)                \
@@ -193,6 +367,10 @@ void Socket_SetOption(Socket *, ags_t level, ags_t option, ags_t value);
 	AGS_METHOD  (Socket, SendDataTo, 2)          \
 	AGS_METHOD  (Socket, RecvData, 0)            \
 	AGS_METHOD  (Socket, RecvDataFrom, 1)        \
+	AGS_METHOD  (Socket, QueueTo, 2)             \
+	AGS_METHOD  (Socket, QueueDataTo, 2)         \
+	AGS_METHOD  (Socket, SendQueued, 0)          \
+	AGS_METHOD  (Socket, QueuedError, 1)         \
 	AGS_METHOD  (Socket, GetOption, 2)           \
 	AGS_METHOD  (Socket, SetOption, 3)
 
@@ -10,12 +10,17 @@
 
 #include <cstdlib>
 #include <iostream>
+#include <string>
 
+#include "API.h"
 #include "Buffer.h"
+#include "Scan.h"
 #include "Test.h"
 
 using namespace AGSSock;
 
+using AGSSockAPI::Thread;
+
 //------------------------------------------------------------------------------
 
 Test test1("buffers with datagram inputs", []()
@@ -87,6 +92,319 @@ Test test2("buffers with stream inputs", []()
 	return true;
 });
 
+//------------------------------------------------------------------------------
+
+Test test3("buffers with stream messages", []()
+{
+	Buffer buffer;
+
+	buffer.append("ABC\0DEF", 7);
+	EXPECT(std::string(buffer.message()) == "ABC");
+	buffer.extract();
+
+	// Data arriving in between continues the partial message
+	buffer.append("GHI\0\0", 5);
+	EXPECT(std::string(buffer.message()) == "DEFGHI");
+	buffer.extract();
+	EXPECT(buffer.empty());
+
+	buffer.append("JKL\0MNO", 7);
+	buffer.extract();
+	buffer.append("PQR", 3);
+
+	// Accessing the front discards what was extracted
+	EXPECT(buffer.front() == "MNOPQR");
+	EXPECT(std::string(buffer.message()) == "MNOPQR");
+	buffer.extract();
+	EXPECT(buffer.empty());
+
+	return true;
+});
+
+//------------------------------------------------------------------------------
+
+Test test4("delimiter scanning", []()
+{
+	// Every position and alignment should be found
+	std::string data(200, 'x');
+	for (size_t offset = 0; offset < 40; ++offset)
+		for (size_t pos = offset; pos < data.size(); ++pos)
+		{
+			data[pos] = '\n';
+			const char *begin = data.data() + offset, *end = data.data() + data.size();
+			EXPECT(scan(begin, end, '\n') == data.data() + pos);
+			EXPECT(scan(begin, end, 'y') == end);
+			data[pos] = 'x';
+		}
+
+	const char text[] = "ab\r\rc\r\n";
+	const char *end = text + sizeof (text) - 1;
+	EXPECT(scan(text, end, "\r\n", 2) == text + 5);
+	EXPECT(scan(text, end, "\n\r", 2) == end);
+	EXPECT(scan(text, text + 1, "\r\n", 2) == text + 1);
+
+	return true;
+});
+
+//------------------------------------------------------------------------------
+
+Test test5("buffers with delimited messages", []()
+{
+	Buffer buffer;
+	std::string message;
+	const std::string crlf = "\r\n";
+
+	buffer.append("GET / HTTP/1.0\r", 15);
+	EXPECT(!buffer.complete(crlf));
+	EXPECT(!buffer.extract(crlf, message));
+
+	// The delimiter may be split over two receives
+	buffer.append("\nHost: x\r\n\r\nbody", 16);
+	EXPECT(buffer.complete(crlf));
+	EXPECT(buffer.extract(crlf, message));
+	EXPECT(message == "GET / HTTP/1.0");
+	EXPECT(buffer.extract(crlf, message));
+	EXPECT(message == "Host: x");
+
+	// Empty messages are skipped, incomplete messages are kept
+	size_t size = buffer.size();
+	EXPECT(!buffer.complete(crlf));
+	EXPECT(buffer.size() == size);
+	EXPECT(!buffer.extract(crlf, message));
+	EXPECT(!buffer.empty());
+
+	// Once the stream ends the remainder is the final message
+	buffer.append(nullptr, 0);
+	EXPECT(buffer.complete(crlf));
+	EXPECT(buffer.extract(crlf, message));
+	EXPECT(message == "body");
+	EXPECT(buffer.extract(crlf, message));
+	EXPECT(message.empty());
+	EXPECT(buffer.empty());
+
+	// Packets are delimited separately
+	buffer.push("a\nb", 3);
+	buffer.push("c\n", 2);
+	EXPECT(buffer.extract("\n", message) && message == "a");
+	EXPECT(buffer.extract("\n", message) && message == "b");
+	EXPECT(buffer.extract("\n", message) && message == "c");
+	EXPECT(buffer.empty());
+
+	return true;
+});
+
+//------------------------------------------------------------------------------
+
+Test test6("buffers with concurrent datagram inputs", []()
+{
+	Buffer buffer;
+	const int count = 200000;
+
+	// One thread pushes numbered packets while this one pops them
+	Thread *producer = nullptr;
+	producer = new Thread([&]()
+	{
+		for (int i = 0; i < count; ++i)
+		{
+			std::string packet = std::to_string(i);
+			buffer.push(packet.data(), packet.size());
+		}
+		producer->exit();
+	});
+	producer->start();
+
+	for (int i = 0; i < count; )
+	{
+		if (buffer.empty())
+			continue;
+
+		EXPECT(buffer.front() == std::to_string(i).c_str());
+		buffer.pop();
+		++i;
+	}
+	EXPECT(buffer.empty());
+
+	delete producer;
+	return true;
+});
+
+//------------------------------------------------------------------------------
+
+Test test7("buffers with concurrent stream inputs", []()
+{
+	Buffer buffer;
+	const int count = 200000;
+
+	// One thread appends a counting byte stream in chunks of varying size
+	// while this one takes whatever has arrived
+	Thread *producer = nullptr;
+	producer = new Thread([&]()
+	{
+		char chunk[16];
+		for (int i = 0; i < count; )
+		{
+			int size = 1 + i % sizeof (chunk);
+			for (int j = 0; j < size; ++j)
+				chunk[j] = (char) ('A' + (i + j) % 26);
+			buffer.append(chunk, size);
+			i += size;
+		}
+		buffer.append(nullptr, 0);
+		producer->exit();
+	});
+	producer->start();
+
+	int received = 0;
+	bool eof = false;
+	while (!eof)
+	{
+		if (buffer.empty())
+			continue;
+
+		Bytes &data = buffer.front();
+		if (data.empty())
+			eof = true;
+		for (char c : data)
+			EXPECT(c == (char) ('A' + received++ % 26));
+		buffer.pop();
+	}
+	EXPECT(received >= count);
+	EXPECT(buffer.empty());
+
+	delete producer;
+	return true;
+});
+
+//------------------------------------------------------------------------------
+
+Test test8("buffers gathered for sending", []()
+{
+	Buffer buffer;
+	Buffer::Chunk chunks[4];
+	EXPECT(buffer.gather(chunks, 4) == 0);
+
+	buffer.push("ABC", 3);
+	buffer.push("DEFG", 4);
+	buffer.push("H", 1);
+
+	// Gathering does not remove anything
+	EXPECT(buffer.gather(chunks, 2) == 2);
+	EXPECT(buffer.gather(chunks, 4) == 3);
+	EXPECT(std::string(chunks[1].data, chunks[1].size) == "DEFG");
+
+	// Consuming may end halfway through an element
+	buffer.consume(5);
+	EXPECT(buffer.gather(chunks, 4) == 2);
+	EXPECT(std::string(chunks[0].data, chunks[0].size) == "FG");
+	EXPECT(std::string(chunks[1].data, chunks[1].size) == "H");
+
+	buffer.consume(3);
+	EXPECT(buffer.empty());
+
+	return true;
+});
+
+//------------------------------------------------------------------------------
+
+Test test9("buffers taking over strings", []()
+{
+	Buffer buffer;
+
+	// Large strings are not copied when moved into the buffer
+	Bytes data(20000, 'x');
+	const char *storage = data.data();
+	buffer.push(data);
+	EXPECT(data.empty());
+	EXPECT(buffer.front().size() == 20000);
+	EXPECT(buffer.front().data() == storage);
+	buffer.pop();
+	EXPECT(buffer.empty());
+
+	// Streams are continued as usual
+	data.assign("ABC\0DEF", 7);
+	buffer.append(data);
+	data.assign("GHI\0", 4);
+	buffer.append(data);
+	data.clear();
+	buffer.append(data);
+	EXPECT(std::string(buffer.message()) == "ABC");
+	buffer.extract();
+	EXPECT(std::string(buffer.message()) == "DEFGHI");
+	buffer.extract();
+	EXPECT(buffer.front().empty());
+	buffer.pop();
+	EXPECT(buffer.empty());
+
+	return true;
+});
+
+Test test10("slab recycling", []()
+{
+	// Sizes within a class share blocks
+	void *block = Slab::allocate(100);
+	Slab::Statistics before = Slab::statistics();
+	Slab::deallocate(block, 100);
+	EXPECT(Slab::statistics().held > before.held);
+	EXPECT(Slab::allocate(97) == block);
+	Slab::Statistics after = Slab::statistics();
+	EXPECT(after.hits == before.hits + 1);
+	EXPECT(after.held == before.held);
+	Slab::deallocate(block, 97);
+
+	// Oversized blocks are left to the heap
+	block = Slab::allocate(1 << 20);
+	EXPECT(Slab::statistics().misses == after.misses + 1);
+	Slab::deallocate(block, 1 << 20);
+
+	// Received data is stored in recycled memory
+	std::string message(100, 'x');
+	before = Slab::statistics();
+	{
+		Buffer buffer;
+		buffer.push(message.data(), message.size());
+		buffer.pop();
+		buffer.push(message.data(), message.size());
+	}
+	EXPECT(Slab::statistics().hits > before.hits);
+
+	return true;
+});
+
+Test test11("buffer fill level", []()
+{
+	Buffer buffer;
+	EXPECT(buffer.size() == 0);
+
+	buffer.append("ABC\0DEF", 7);
+	buffer.append("GHI\0", 4);
+	EXPECT(buffer.size() == 11);
+
+	// Extracted data no longer counts, even before the front is accessed
+	buffer.extract();
+	EXPECT(buffer.size() == 7);
+	EXPECT(buffer.removed() == 4);
+	EXPECT(buffer.front().size() == 7);
+	EXPECT(buffer.size() == 7);
+
+	// Data taken from the front counts as removed once popped
+	Bytes data;
+	data.swap(buffer.front());
+	buffer.pop();
+	EXPECT(buffer.size() == 0);
+	EXPECT(buffer.removed() == 11);
+
+	buffer.push("12345", 5);
+	buffer.consume(2);
+	EXPECT(buffer.size() == 3);
+	buffer.consume(3);
+	EXPECT(buffer.size() == 0);
+	EXPECT(buffer.empty());
+
+	return true;
+});
+
+//------------------------------------------------------------------------------
+
 int main(int argc, char const *argv[])
 {
 	return Test::run_tests() ? EXIT_SUCCESS : EXIT_FAILURE;
@@ -17,8 +17,11 @@
 
 #ifdef _WIN32
 	#include <windows.h>
+	#define m_sleep(x) Sleep(x)
 #else
 	#include <sys/socket.h>
+	#include <unistd.h>
+	#define m_sleep(x) usleep(x * 1000)
 #endif
 
 using std::string;
@@ -163,6 +166,100 @@ Test test5("reverse resolving **internet access required**", []()
 
 //------------------------------------------------------------------------------
 
+Test test6("looking up addresses in the background", []()
+{
+	using namespace AGSMock;
+
+	// Null means the lookup is still going on
+	Handle<SockAddr> addr;
+	for (int i = 0; i < 500 && !addr; ++i)
+	{
+		addr = Call<SockAddr *>("SockAddr::Lookup^2", "localhost:4321",
+			(ags_t) AF_INET);
+		if (!addr)
+			m_sleep(10);
+	}
+	EXPECT(!!addr);
+
+	{
+		int port = Call<ags_t>("SockAddr::get_Port", addr.get());
+		EXPECT(port == 4321);
+
+		Handle<const char> ip = Call<const char *>("SockAddr::get_IP", &*addr);
+		EXPECT(string("127.0.0.1") == ip.get());
+	}
+
+	// Once found it is remembered, so it is there right away
+	Handle<SockAddr> again = Call<SockAddr *>("SockAddr::Lookup^2",
+		"localhost:4321", (ags_t) AF_INET);
+	EXPECT(!!again);
+	EXPECT(Call<ags_t>("SockAddr::get_Port", again.get()) == 4321);
+
+	// As it is for lookups that wait
+	Handle<SockAddr> waited = Call<SockAddr *>("SockAddr::CreateFromString^2",
+		"localhost:4321", (ags_t) AF_INET);
+	Handle<const char> ip = Call<const char *>("SockAddr::get_IP", &*waited);
+	EXPECT(string("127.0.0.1") == ip.get());
+
+	return true;
+});
+
+//------------------------------------------------------------------------------
+
+Test test7("names of addresses", []()
+{
+	using namespace AGSMock;
+
+	Handle<SockAddr> addr = Call<SockAddr *>("SockAddr::CreateIP^2",
+		"127.0.0.1", (ags_t) 4567);
+
+	// Numbers are formatted without looking up anything
+	Call<void>("SockAddr::SetAddressLookup^1", (ags_t) 0);
+	{
+		Handle<const char> str = Call<const char *>("SockAddr::get_Address",
+			addr.get());
+		EXPECT(string("127.0.0.1:4567") == str.get());
+	}
+
+	// In the background the numbers are used until the names are known
+	Call<void>("SockAddr::SetAddressLookup^1", (ags_t) 2);
+	{
+		Handle<const char> str = Call<const char *>("SockAddr::get_Address",
+			addr.get());
+		EXPECT(string("127.0.0.1:4567") == str.get());
+	}
+
+	// Names that were waited for are remembered
+	Call<void>("SockAddr::SetAddressLookup^1", (ags_t) 1);
+	Handle<const char> waited = Call<const char *>("SockAddr::get_Address",
+		addr.get());
+	EXPECT(waited && waited.get()[0] != '\0');
+	Call<void>("SockAddr::SetAddressLookup^1", (ags_t) 2);
+	{
+		Handle<const char> str = Call<const char *>("SockAddr::get_Address",
+			addr.get());
+		EXPECT(string(waited.get()) == str.get());
+	}
+
+	// The host is remembered whatever port the next connection comes from
+	{
+		Handle<SockAddr> other = Call<SockAddr *>("SockAddr::CreateIP^2",
+			"127.0.0.1", (ags_t) 4568);
+		Handle<const char> str = Call<const char *>("SockAddr::get_Address",
+			other.get());
+		string expected = waited.get();
+		size_t index = expected.rfind(":4567");
+		EXPECT(index != string::npos);
+		expected.replace(index, 5, ":4568");
+		EXPECT(expected == str.get());
+	}
+	Call<void>("SockAddr::SetAddressLookup^1", (ags_t) 1);
+
+	return true;
+});
+
+//------------------------------------------------------------------------------
+
 int main(int argc, char const *argv[])
 {
 	AGSMock::Initialize();
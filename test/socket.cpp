@@ -8,6 +8,7 @@
  * Description: Testing the Socket AGS struct          *
  *******************************************************/
 
+#include <chrono>
 #include <cstdlib>
 #include <iostream>
 #include <string>
@@ -54,6 +55,14 @@ struct SockData {};
 #define AGSSOCK_NETWORK_NOT_AVAILABLE 11
 #define AGSSOCK_NOT_CONNECTED         12
 
+#define AGSSOCK_LEVEL         -1
+#define AGSSOCK_READ_MINIMUM   1
+#define AGSSOCK_READ_MAXIMUM   2
+#define AGSSOCK_NO_DELAY       3
+#define AGSSOCK_RECEIVE_BUFFER 4
+#define AGSSOCK_REUSE_ADDRESS  8
+#define AGSSOCK_LINGER        10
+
 //------------------------------------------------------------------------------
 
 #define REPORT(x, sock) do { \
@@ -401,6 +410,991 @@ Test test4("error values", []()
 
 //------------------------------------------------------------------------------
 
+Test test5("many local UDP connections", []()
+{
+	using namespace AGSMock;
+
+	cout << endl;
+
+	// Sockets are spread over multiple pools; all of them should be served
+	const int count = 16;
+	Handle<Socket> to[count], from[count];
+
+	for (int i = 0; i < count; ++i)
+	{
+		to[i] = Call<Socket *>("Socket::CreateUDP^0");
+		from[i] = Call<Socket *>("Socket::CreateUDP^0");
+		EXPECT(Call<ags_t>("Socket::get_Valid", to[i].get()));
+		EXPECT(Call<ags_t>("Socket::get_Valid", from[i].get()));
+
+		Handle<SockAddr> addr = Call<SockAddr *>("SockAddr::CreateIP^2",
+			"127.0.0.1", (ags_t) 0);
+		ags_t ret = Call<ags_t>("Socket::Bind^1", to[i].get(), addr.get());
+		REPORT(ret, to[i]);
+		EXPECT(ret);
+
+		Handle<SockAddr> local = Call<SockAddr *>("Socket::get_Local",
+			to[i].get());
+		ret = Call<ags_t>("Socket::Connect^2", from[i].get(), local.get(),
+			(ags_t) 0);
+		REPORT(ret, from[i]);
+		EXPECT(ret);
+	}
+
+	for (int i = 0; i < count; ++i)
+	{
+		string msg = "Test" + std::to_string(i);
+		ags_t ret = Call<ags_t>("Socket::Send^1", from[i].get(), msg.c_str());
+		REPORT(ret, from[i]);
+		EXPECT(ret);
+	}
+
+	// We expect every socket to receive its own data eventually
+	for (int i = 0; i < count; ++i)
+	{
+		bool received = false;
+		for (int j = 0; j < 100 && !received; ++j)
+		{
+			Handle<const char> data = Call<const char *>("Socket::Recv^0",
+				to[i].get());
+			REPORT(!!data, to[i]);
+			EXPECT(data || to[i]->error == 0);
+			if (data)
+			{
+				EXPECT(("Test" + std::to_string(i)) == data.get());
+				received = true;
+			}
+			else
+				m_sleep(10);
+		}
+		EXPECT(received);
+	}
+
+	for (int i = 0; i < count; ++i)
+	{
+		Call<void>("Socket::Close^0", to[i].get());
+		Call<void>("Socket::Close^0", from[i].get());
+	}
+
+	return true;
+});
+
+//------------------------------------------------------------------------------
+
+Test test6("local TCP connection with delimiter", []()
+{
+	using namespace AGSMock;
+
+	cout << endl;
+
+	Handle<Socket> server = Call<Socket *>("Socket::CreateTCP^0");
+	Handle<Socket> client = Call<Socket *>("Socket::CreateTCP^0");
+	EXPECT(Call<ags_t>("Socket::get_Valid", server.get()));
+	EXPECT(Call<ags_t>("Socket::get_Valid", client.get()));
+
+	{
+		Handle<SockAddr> addr = Call<SockAddr *>("SockAddr::CreateIP^2",
+			"127.0.0.1", (ags_t) 0);
+		ags_t ret = Call<ags_t>("Socket::Bind^1", server.get(), addr.get());
+		REPORT(ret, server);
+		EXPECT(ret);
+		ret = Call<ags_t>("Socket::Listen^1", server.get(), (ags_t) 10);
+		REPORT(ret, server);
+		EXPECT(ret);
+	}
+
+	{
+		Handle<SockAddr> addr = Call<SockAddr *>("Socket::get_Local",
+			server.get());
+		ags_t ret = Call<ags_t>("Socket::Connect^2", client.get(),
+			addr.get(), (ags_t) 0);
+		REPORT(ret, client);
+		EXPECT(ret);
+	}
+
+	Handle<Socket> conn = Call<Socket *>("Socket::Accept^0", server.get());
+	EXPECT(!!conn);
+
+	Call<void>("Socket::set_Delimiter", conn.get(), "\r\n");
+	{
+		Handle<const char> delimiter = Call<const char *>(
+			"Socket::get_Delimiter", conn.get());
+		EXPECT(string("\r\n") == delimiter.get());
+	}
+
+	{
+		ags_t ret = Call<ags_t>("Socket::Send^1", client.get(),
+			"Line 1\r\nLine 2\r\nLine");
+		REPORT(ret, client);
+		EXPECT(ret);
+	}
+
+	// We expect the complete lines only, in order
+	const char *lines[] = {"Line 1", "Line 2"};
+	for (const char *line : lines)
+	{
+		bool received = false;
+		for (int i = 0; i < 100 && !received; ++i)
+		{
+			Handle<const char> data = Call<const char *>("Socket::Recv^0",
+				conn.get());
+			REPORT(!!data, conn);
+			EXPECT(data || conn->error == 0);
+			if (data)
+			{
+				EXPECT(string(line) == data.get());
+				received = true;
+			}
+			else
+				m_sleep(10);
+		}
+		EXPECT(received);
+	}
+	{
+		Handle<const char> data = Call<const char *>("Socket::Recv^0",
+			conn.get());
+		EXPECT(!data && conn->error == 0);
+	}
+
+	// Part of a line is nothing to wait for, even split within the delimiter
+	EXPECT(!Call<ags_t>("Socket::Wait^1", conn.get(), (ags_t) 50));
+	EXPECT(!Call<ags_t>("Socket::get_Pending", conn.get()));
+	EXPECT(Call<ags_t>("Socket::Send^1", client.get(), " 3\r"));
+	EXPECT(!Call<ags_t>("Socket::Wait^1", conn.get(), (ags_t) 50));
+	EXPECT(!Call<ags_t>("Socket::get_Pending", conn.get()));
+	EXPECT(Call<ags_t>("Socket::Send^1", client.get(), "\n"));
+	EXPECT(Call<ags_t>("Socket::Wait^1", conn.get(), (ags_t) 1000));
+	EXPECT(Call<ags_t>("Socket::get_Pending", conn.get()));
+	{
+		Handle<const char> data = Call<const char *>("Socket::Recv^0",
+			conn.get());
+		REPORT(!!data, conn);
+		EXPECT(data && string("Line 3") == data.get());
+	}
+
+	Call<void>("Socket::Close^0", client.get());
+	Call<void>("Socket::Close^0", conn.get());
+	Call<void>("Socket::Close^0", server.get());
+
+	return true;
+});
+
+//------------------------------------------------------------------------------
+
+Test test7("local TCP connection with a large send", []()
+{
+	using namespace AGSMock;
+
+	cout << endl;
+
+	Handle<Socket> server = Call<Socket *>("Socket::CreateTCP^0");
+	Handle<Socket> client = Call<Socket *>("Socket::CreateTCP^0");
+	EXPECT(Call<ags_t>("Socket::get_Valid", server.get()));
+	EXPECT(Call<ags_t>("Socket::get_Valid", client.get()));
+
+	{
+		Handle<SockAddr> addr = Call<SockAddr *>("SockAddr::CreateIP^2",
+			"127.0.0.1", (ags_t) 0);
+		ags_t ret = Call<ags_t>("Socket::Bind^1", server.get(), addr.get());
+		REPORT(ret, server);
+		EXPECT(ret);
+		ret = Call<ags_t>("Socket::Listen^1", server.get(), (ags_t) 10);
+		REPORT(ret, server);
+		EXPECT(ret);
+	}
+
+	{
+		Handle<SockAddr> addr = Call<SockAddr *>("Socket::get_Local",
+			server.get());
+		ags_t ret = Call<ags_t>("Socket::Connect^2", client.get(),
+			addr.get(), (ags_t) 0);
+		REPORT(ret, client);
+		EXPECT(ret);
+	}
+
+	Handle<Socket> conn = Call<Socket *>("Socket::Accept^0", server.get());
+	EXPECT(!!conn);
+
+	// The receiver holds back so its pool does not drain the connection
+	Call<void>("Socket::set_ReceiveLimit", conn.get(), (ags_t) 65536);
+
+	// Far more than the socket buffers hold, so most of it is queued
+	const int count = 256, size = 65536;
+	string block(size, ' ');
+	for (int i = 0; i < count; ++i)
+	{
+		block.assign(size, (char) ('A' + i % 26));
+		ags_t ret = Call<ags_t>("Socket::Send^1", client.get(), block.c_str());
+		REPORT(ret, client);
+		EXPECT(ret);
+	}
+	EXPECT(Call<ags_t>("Socket::get_Unsent", client.get()) > 0);
+
+	// Beyond the limit sending should be tried again later
+	Call<void>("Socket::set_SendLimit", client.get(), (ags_t) 1);
+	EXPECT(Call<ags_t>("Socket::get_SendLimit", client.get()) == 1);
+	EXPECT(!Call<ags_t>("Socket::Send^1", client.get(), "X"));
+	EXPECT(Call<ags_t>("Socket::ErrorValue^0", client.get()) == AGSSOCK_NO_ERROR);
+	Call<void>("Socket::set_SendLimit", client.get(), (ags_t) 0);
+
+	// More than the limit is refused, even when nothing is queued yet
+	Call<void>("Socket::set_SendLimit", conn.get(), (ags_t) 4);
+	EXPECT(!Call<ags_t>("Socket::Send^1", conn.get(), "Limit"));
+	EXPECT(Call<ags_t>("Socket::ErrorValue^0", conn.get())
+		== AGSSOCK_NOT_ENOUGH_RESOURCES);
+	EXPECT(Call<ags_t>("Socket::get_Unsent", conn.get()) == 0);
+	Call<void>("Socket::set_SendLimit", conn.get(), (ags_t) 0);
+
+	// Closing leaves the queued data for the pool to send
+	Call<void>("Socket::Close^0", client.get());
+
+	// We expect all data in order, followed by the end of the stream
+	long received = 0;
+	bool eof = false;
+	for (int i = 0; i < 1000 && !eof; ++i)
+	{
+		Handle<SockData> data = Call<SockData *>("Socket::RecvData^0",
+			conn.get());
+		REPORT(!!data, conn);
+		EXPECT(data || conn->error == 0);
+		if (!data)
+		{
+			m_sleep(10);
+			continue;
+		}
+
+		Handle<const char> chars = Call<const char *>("SockData::AsString^0",
+			data.get());
+		string str = chars.get();
+		EXPECT((ags_t) str.size() == Call<ags_t>("SockData::get_Size", data.get()));
+		if (str.empty())
+			eof = true;
+		for (char c : str)
+			EXPECT(c == (char) ('A' + received++ / size % 26));
+	}
+	EXPECT(eof);
+	EXPECT(received == (long) count * size);
+	EXPECT(Call<ags_t>("Socket::get_Unsent", client.get()) == 0);
+
+	Call<void>("Socket::Close^0", conn.get());
+	Call<void>("Socket::Close^0", server.get());
+
+	return true;
+});
+
+//------------------------------------------------------------------------------
+
+Test test8("batched UDP sends", []()
+{
+	using namespace AGSMock;
+
+	cout << endl;
+
+	const int count = 8;
+	Handle<Socket> to[count];
+	Handle<Socket> from = Call<Socket *>("Socket::CreateUDP^0");
+	EXPECT(Call<ags_t>("Socket::get_Valid", from.get()));
+
+	for (int i = 0; i < count; ++i)
+	{
+		to[i] = Call<Socket *>("Socket::CreateUDP^0");
+		EXPECT(Call<ags_t>("Socket::get_Valid", to[i].get()));
+
+		Handle<SockAddr> addr = Call<SockAddr *>("SockAddr::CreateIP^2",
+			"127.0.0.1", (ags_t) 0);
+		ags_t ret = Call<ags_t>("Socket::Bind^1", to[i].get(), addr.get());
+		REPORT(ret, to[i]);
+		EXPECT(ret);
+
+		Handle<SockAddr> local = Call<SockAddr *>("Socket::get_Local",
+			to[i].get());
+		string msg = "Test" + std::to_string(i);
+		Call<void>("Socket::QueueTo^2", from.get(), local.get(), msg.c_str());
+	}
+
+	// One destination that cannot be sent to should not stop the others
+	{
+		Handle<SockAddr> addr = Call<SockAddr *>("SockAddr::CreateIP^2",
+			"0.0.0.0", (ags_t) 0);
+		Call<void>("Socket::QueueTo^2", from.get(), addr.get(), "Invalid");
+	}
+
+	ags_t sent = Call<ags_t>("Socket::SendQueued^0", from.get());
+	EXPECT(sent == count);
+	for (int i = 0; i < count; ++i)
+		EXPECT(Call<ags_t>("Socket::QueuedError^1", from.get(), (ags_t) i)
+			== AGSSOCK_NO_ERROR);
+	EXPECT(Call<ags_t>("Socket::QueuedError^1", from.get(), (ags_t) count)
+		!= AGSSOCK_NO_ERROR);
+
+	// The queue is emptied by sending it
+	EXPECT(Call<ags_t>("Socket::SendQueued^0", from.get()) == 0);
+
+	for (int i = 0; i < count; ++i)
+	{
+		bool received = false;
+		for (int j = 0; j < 100 && !received; ++j)
+		{
+			Handle<const char> data = Call<const char *>("Socket::Recv^0",
+				to[i].get());
+			REPORT(!!data, to[i]);
+			EXPECT(data || to[i]->error == 0);
+			if (data)
+			{
+				EXPECT(("Test" + std::to_string(i)) == data.get());
+				received = true;
+			}
+			else
+				m_sleep(10);
+		}
+		EXPECT(received);
+	}
+
+	// Streams have no use for queued datagrams
+	{
+		Handle<Socket> stream = Call<Socket *>("Socket::CreateTCP^0");
+		Handle<SockAddr> addr = Call<SockAddr *>("Socket::get_Local",
+			to[0].get());
+		Call<void>("Socket::QueueTo^2", stream.get(), addr.get(), "Stream");
+		EXPECT(Call<ags_t>("Socket::ErrorValue^0", stream.get())
+			== AGSSOCK_UNSUPPORTED);
+		EXPECT(Call<ags_t>("Socket::SendQueued^0", stream.get()) == 0);
+		Call<void>("Socket::Close^0", stream.get());
+	}
+
+	for (int i = 0; i < count; ++i)
+		Call<void>("Socket::Close^0", to[i].get());
+	Call<void>("Socket::Close^0", from.get());
+
+	return true;
+});
+
+//------------------------------------------------------------------------------
+
+Test test9("UDP receiving from several hosts", []()
+{
+	using namespace AGSMock;
+
+	cout << endl;
+
+	Handle<Socket> server = Call<Socket *>("Socket::CreateUDP^0");
+	Handle<Socket> client[2];
+	EXPECT(Call<ags_t>("Socket::get_Valid", server.get()));
+
+	Handle<SockAddr> serv_addr;
+	{
+		Handle<SockAddr> addr = Call<SockAddr *>("SockAddr::CreateIP^2",
+			"127.0.0.1", (ags_t) 0);
+		ags_t ret = Call<ags_t>("Socket::Bind^1", server.get(), addr.get());
+		REPORT(ret, server);
+		EXPECT(ret);
+		serv_addr = Call<SockAddr *>("Socket::get_Local", server.get());
+	}
+
+	// The clients are not bound, sending does that implicitly
+	for (int i = 0; i < 2; ++i)
+	{
+		client[i] = Call<Socket *>("Socket::CreateUDP^0");
+		string msg = "Test" + std::to_string(i);
+		ags_t ret = Call<ags_t>("Socket::SendTo^2", client[i].get(),
+			serv_addr.get(), msg.c_str());
+		REPORT(ret, client[i]);
+		EXPECT(ret);
+	}
+
+	// Every datagram should be attributed to the client that sent it
+	for (int i = 0; i < 2; )
+	{
+		Handle<SockAddr> source = Call<SockAddr *>("SockAddr::Create^1",
+			(ags_t) -1);
+		Handle<const char> data = Call<const char *>("Socket::RecvFrom^1",
+			server.get(), source.get());
+		if (!data)
+		{
+			EXPECT(Call<ags_t>("Socket::ErrorValue^0", server.get())
+				== AGSSOCK_PLEASE_TRY_AGAIN);
+			m_sleep(10);
+			continue;
+		}
+
+		int n = string(data.get()) == "Test0" ? 0 : 1;
+		EXPECT(("Test" + std::to_string(n)) == data.get());
+		Handle<SockAddr> local = Call<SockAddr *>("Socket::get_Local",
+			client[n].get());
+		EXPECT(Call<ags_t>("SockAddr::get_Port", source.get())
+			== Call<ags_t>("SockAddr::get_Port", local.get()));
+
+		// Reply to the sender
+		ags_t ret = Call<ags_t>("Socket::SendTo^2", server.get(),
+			source.get(), data.get());
+		REPORT(ret, server);
+		EXPECT(ret);
+		++i;
+	}
+
+	// The clients should receive their own messages back from the server,
+	// the first time they try once it arrived: sending had the pool read them
+	for (int i = 0; i < 2; ++i)
+	{
+		EXPECT(Call<ags_t>("Socket::Wait^1", client[i].get(), (ags_t) 1000));
+		Handle<SockAddr> source = Call<SockAddr *>("SockAddr::Create^1",
+			(ags_t) -1);
+		Handle<SockData> data = Call<SockData *>("Socket::RecvDataFrom^1",
+			client[i].get(), source.get());
+		REPORT(!!data, client[i]);
+		EXPECT(!!data);
+		Handle<const char> str = Call<const char *>(
+			"SockData::AsString^0", data.get());
+		EXPECT(("Test" + std::to_string(i)) == str.get());
+		EXPECT(Call<ags_t>("SockAddr::get_Port", source.get())
+			== Call<ags_t>("SockAddr::get_Port", serv_addr.get()));
+	}
+
+	Call<void>("Socket::Close^0", client[0].get());
+	Call<void>("Socket::Close^0", client[1].get());
+	Call<void>("Socket::Close^0", server.get());
+
+	return true;
+});
+
+//------------------------------------------------------------------------------
+
+Test test10("UDP receive limit", []()
+{
+	using namespace AGSMock;
+
+	cout << endl;
+
+	Handle<Socket> server = Call<Socket *>("Socket::CreateUDP^0");
+	Handle<Socket> client = Call<Socket *>("Socket::CreateUDP^0");
+
+	Handle<SockAddr> serv_addr;
+	{
+		Handle<SockAddr> addr = Call<SockAddr *>("SockAddr::CreateIP^2",
+			"127.0.0.1", (ags_t) 0);
+		ags_t ret = Call<ags_t>("Socket::Bind^1", server.get(), addr.get());
+		REPORT(ret, server);
+		EXPECT(ret);
+		serv_addr = Call<SockAddr *>("Socket::get_Local", server.get());
+	}
+
+	// Messages beyond the limit are dropped and counted
+	Call<void>("Socket::set_ReceiveLimit", server.get(), (ags_t) 10);
+	EXPECT(Call<ags_t>("Socket::get_ReceiveLimit", server.get()) == 10);
+	for (int i = 0; i < 4; ++i)
+		EXPECT(Call<ags_t>("Socket::SendTo^2", client.get(), serv_addr.get(),
+			"message"));
+
+	for (int i = 0; i < 100
+		&& Call<ags_t>("Socket::get_Dropped", server.get()) < 2; ++i)
+		m_sleep(10);
+	EXPECT(Call<ags_t>("Socket::get_Dropped", server.get()) == 2);
+	EXPECT(Call<ags_t>("Socket::get_Unread", server.get()) == 14);
+
+	Handle<SockAddr> source = Call<SockAddr *>("SockAddr::Create^1",
+		(ags_t) -1);
+	Handle<const char> data = Call<const char *>("Socket::RecvFrom^1",
+		server.get(), source.get());
+	EXPECT(data && string(data.get()) == "message");
+	EXPECT(Call<ags_t>("Socket::get_Unread", server.get()) == 7);
+
+	// A limit for all sockets together applies as well
+	Call<void>("Socket::SetTotalReceiveLimit^1", (ags_t) 1);
+	Call<void>("Socket::set_ReceiveLimit", server.get(), (ags_t) 0);
+	EXPECT(Call<ags_t>("Socket::SendTo^2", client.get(), serv_addr.get(),
+		"message"));
+	for (int i = 0; i < 100
+		&& Call<ags_t>("Socket::get_Dropped", server.get()) < 3; ++i)
+		m_sleep(10);
+	EXPECT(Call<ags_t>("Socket::get_Dropped", server.get()) == 3);
+	Call<void>("Socket::SetTotalReceiveLimit^1", (ags_t) (64 << 20));
+
+	Call<void>("Socket::Close^0", client.get());
+	Call<void>("Socket::Close^0", server.get());
+
+	return true;
+});
+
+//------------------------------------------------------------------------------
+
+Test test11("read size options", []()
+{
+	using namespace AGSMock;
+
+	cout << endl;
+
+	Handle<Socket> server = Call<Socket *>("Socket::CreateTCP^0");
+	Handle<Socket> client = Call<Socket *>("Socket::CreateTCP^0");
+
+	// The bounds can be moved as long as the minimum stays below the maximum
+	EXPECT(Call<ags_t>("Socket::GetOption^2", server.get(),
+		(ags_t) AGSSOCK_LEVEL, (ags_t) AGSSOCK_READ_MINIMUM) == 4096);
+	EXPECT(Call<ags_t>("Socket::SetOption^3", server.get(),
+		(ags_t) AGSSOCK_LEVEL, (ags_t) AGSSOCK_READ_MAXIMUM, (ags_t) 8192));
+	EXPECT(Call<ags_t>("Socket::SetOption^3", server.get(),
+		(ags_t) AGSSOCK_LEVEL, (ags_t) AGSSOCK_READ_MINIMUM, (ags_t) 1024));
+	EXPECT(!Call<ags_t>("Socket::SetOption^3", server.get(),
+		(ags_t) AGSSOCK_LEVEL, (ags_t) AGSSOCK_READ_MINIMUM, (ags_t) 16384));
+	EXPECT(Call<ags_t>("Socket::ErrorValue^0", server.get()) == AGSSOCK_INVALID);
+	EXPECT(!Call<ags_t>("Socket::SetOption^3", server.get(),
+		(ags_t) AGSSOCK_LEVEL, (ags_t) AGSSOCK_READ_MAXIMUM, (ags_t) 0));
+	EXPECT(Call<ags_t>("Socket::GetOption^2", server.get(),
+		(ags_t) AGSSOCK_LEVEL, (ags_t) AGSSOCK_READ_MAXIMUM) == 8192);
+	EXPECT(Call<ags_t>("Socket::ErrorValue^0", server.get()) == AGSSOCK_NO_ERROR);
+
+	{
+		Handle<SockAddr> addr = Call<SockAddr *>("SockAddr::CreateIP^2",
+			"127.0.0.1", (ags_t) 0);
+		EXPECT(Call<ags_t>("Socket::Bind^1", server.get(), addr.get()));
+		EXPECT(Call<ags_t>("Socket::Listen^1", server.get(), (ags_t) 10));
+		addr = Call<SockAddr *>("Socket::get_Local", server.get());
+		EXPECT(Call<ags_t>("Socket::Connect^2", client.get(), addr.get(),
+			(ags_t) 0));
+	}
+
+	// Connections are read like the socket that accepted them
+	Handle<Socket> conn = Call<Socket *>("Socket::Accept^0", server.get());
+	EXPECT(!!conn);
+	EXPECT(Call<ags_t>("Socket::GetOption^2", conn.get(),
+		(ags_t) AGSSOCK_LEVEL, (ags_t) AGSSOCK_READ_MINIMUM) == 1024);
+	EXPECT(Call<ags_t>("Socket::GetOption^2", conn.get(),
+		(ags_t) AGSSOCK_LEVEL, (ags_t) AGSSOCK_READ_MAXIMUM) == 8192);
+
+	// Whatever the amount read at once, the data arrives whole
+	const int size = 100000;
+	string block(size, 'x');
+	EXPECT(Call<ags_t>("Socket::Send^1", client.get(), block.c_str()));
+	Call<void>("Socket::Close^0", client.get());
+
+	long received = 0;
+	bool eof = false;
+	for (int i = 0; i < 500 && !eof; ++i)
+	{
+		Handle<SockData> data = Call<SockData *>("Socket::RecvData^0",
+			conn.get());
+		if (!data)
+		{
+			m_sleep(10);
+			continue;
+		}
+		ags_t length = Call<ags_t>("SockData::get_Size", data.get());
+		eof = !length;
+		received += length;
+	}
+	EXPECT(eof);
+	EXPECT(received == size);
+
+	Call<void>("Socket::Close^0", conn.get());
+	Call<void>("Socket::Close^0", server.get());
+
+	return true;
+});
+
+//------------------------------------------------------------------------------
+
+Test test12("system options", []()
+{
+	using namespace AGSMock;
+
+	cout << endl;
+
+	Handle<Socket> sock = Call<Socket *>("Socket::CreateTCP^0");
+
+	// Named options are toggled like those of the system
+	EXPECT(Call<ags_t>("Socket::SetOption^3", sock.get(),
+		(ags_t) AGSSOCK_LEVEL, (ags_t) AGSSOCK_NO_DELAY, (ags_t) 1));
+	EXPECT(Call<ags_t>("Socket::GetOption^2", sock.get(),
+		(ags_t) AGSSOCK_LEVEL, (ags_t) AGSSOCK_NO_DELAY) != 0);
+	EXPECT(Call<ags_t>("Socket::ErrorValue^0", sock.get()) == AGSSOCK_NO_ERROR);
+	EXPECT(Call<ags_t>("Socket::SetOption^3", sock.get(),
+		(ags_t) AGSSOCK_LEVEL, (ags_t) AGSSOCK_NO_DELAY, (ags_t) 0));
+	EXPECT(Call<ags_t>("Socket::GetOption^2", sock.get(),
+		(ags_t) AGSSOCK_LEVEL, (ags_t) AGSSOCK_NO_DELAY) == 0);
+
+	// The system may round buffer sizes up, never down
+	EXPECT(Call<ags_t>("Socket::SetOption^3", sock.get(),
+		(ags_t) AGSSOCK_LEVEL, (ags_t) AGSSOCK_RECEIVE_BUFFER, (ags_t) 65536));
+	EXPECT(Call<ags_t>("Socket::GetOption^2", sock.get(),
+		(ags_t) AGSSOCK_LEVEL, (ags_t) AGSSOCK_RECEIVE_BUFFER) >= 65536);
+
+	// Levels other than that of the plugin are passed on as is
+	EXPECT(Call<ags_t>("Socket::SetOption^3", sock.get(),
+		(ags_t) SOL_SOCKET, (ags_t) SO_REUSEADDR, (ags_t) 1));
+	EXPECT(Call<ags_t>("Socket::GetOption^2", sock.get(),
+		(ags_t) AGSSOCK_LEVEL, (ags_t) AGSSOCK_REUSE_ADDRESS) != 0);
+
+	// Options that are not known are unsupported
+	EXPECT(!Call<ags_t>("Socket::SetOption^3", sock.get(),
+		(ags_t) AGSSOCK_LEVEL, (ags_t) 1000, (ags_t) 1));
+	EXPECT(Call<ags_t>("Socket::ErrorValue^0", sock.get()) == AGSSOCK_UNSUPPORTED);
+
+	Call<void>("Socket::Close^0", sock.get());
+
+	// Closed sockets have no options
+	Handle<Socket> closed = Call<Socket *>("Socket::CreateUDP^0");
+	Call<void>("Socket::Close^0", closed.get());
+	EXPECT(Call<ags_t>("Socket::GetOption^2", closed.get(),
+		(ags_t) AGSSOCK_LEVEL, (ags_t) AGSSOCK_RECEIVE_BUFFER) == 0);
+	EXPECT(Call<ags_t>("Socket::ErrorValue^0", closed.get()) == AGSSOCK_SOCKET_NOT_VALID);
+
+	return true;
+});
+
+//------------------------------------------------------------------------------
+
+Test test13("waiting for sockets", []()
+{
+	using namespace AGSMock;
+	using namespace std::chrono;
+
+	cout << endl;
+
+	Handle<Socket> server = Call<Socket *>("Socket::CreateTCP^0");
+	Handle<Socket> client = Call<Socket *>("Socket::CreateTCP^0");
+
+	{
+		Handle<SockAddr> addr = Call<SockAddr *>("SockAddr::CreateIP^2",
+			"127.0.0.1", (ags_t) 0);
+		EXPECT(Call<ags_t>("Socket::Bind^1", server.get(), addr.get()));
+		EXPECT(Call<ags_t>("Socket::Listen^1", server.get(), (ags_t) 10));
+		EXPECT(!Call<ags_t>("Socket::get_Pending", server.get()));
+		addr = Call<SockAddr *>("Socket::get_Local", server.get());
+		EXPECT(Call<ags_t>("Socket::Connect^2", client.get(), addr.get(),
+			(ags_t) 0));
+	}
+
+	// A connection request is something to accept
+	EXPECT(Call<ags_t>("Socket::Wait^1", server.get(), (ags_t) 1000));
+	EXPECT(Call<ags_t>("Socket::get_Pending", server.get()));
+	Handle<Socket> conn = Call<Socket *>("Socket::Accept^0", server.get());
+	EXPECT(!!conn);
+	EXPECT(!Call<ags_t>("Socket::get_Pending", server.get()));
+
+	// Nothing to receive yet, so waiting takes the full time
+	auto start = steady_clock::now();
+	EXPECT(!Call<ags_t>("Socket::Wait^1", conn.get(), (ags_t) 50));
+	EXPECT(steady_clock::now() - start >= milliseconds(45));
+	EXPECT(!Call<ags_t>("Socket::get_Pending", conn.get()));
+	EXPECT(Call<Socket *>("Socket::WaitAny^1", (ags_t) 0) == nullptr);
+
+	// Data that arrives wakes up the wait right away
+	EXPECT(Call<ags_t>("Socket::Send^1", client.get(), "hello"));
+	start = steady_clock::now();
+	Socket *any = Call<Socket *>("Socket::WaitAny^1", (ags_t) 5000);
+	EXPECT(any == conn.get());
+	EXPECT(steady_clock::now() - start < milliseconds(1000));
+	EXPECT(Call<ags_t>("Socket::get_Pending", conn.get()));
+	EXPECT(Call<ags_t>("Socket::Wait^1", conn.get(), (ags_t) 0));
+
+	Handle<const char> msg = Call<const char *>("Socket::Recv^0", conn.get());
+	EXPECT(msg && string(msg.get()) == "hello");
+	EXPECT(!Call<ags_t>("Socket::get_Pending", conn.get()));
+
+	Call<void>("Socket::Close^0", client.get());
+	Call<void>("Socket::Close^0", conn.get());
+	Call<void>("Socket::Close^0", server.get());
+
+	return true;
+});
+
+//------------------------------------------------------------------------------
+
+Test test14("asynchronous connections", []()
+{
+	using namespace AGSMock;
+	using namespace std::chrono;
+
+	cout << endl;
+
+	const size_t COUNT = 8;
+	Handle<Socket> server = Call<Socket *>("Socket::CreateTCP^0");
+	Handle<Socket> clients[COUNT];
+	Handle<SockAddr> addr = Call<SockAddr *>("SockAddr::CreateIP^2",
+		"127.0.0.1", (ags_t) 0);
+	EXPECT(Call<ags_t>("Socket::Bind^1", server.get(), addr.get()));
+	EXPECT(Call<ags_t>("Socket::Listen^1", server.get(), (ags_t) COUNT));
+	addr = Call<SockAddr *>("Socket::get_Local", server.get());
+
+	// All connections are made at once, data sent meanwhile is held back
+	for (size_t i = 0; i < COUNT; ++i)
+	{
+		clients[i] = Call<Socket *>("Socket::CreateTCP^0");
+		EXPECT(!Call<ags_t>("Socket::get_Connected", clients[i].get()));
+		if (!Call<ags_t>("Socket::Connect^2", clients[i].get(), addr.get(),
+			(ags_t) 1))
+		{
+			EXPECT(Call<ags_t>("Socket::ErrorValue^0", clients[i].get())
+				== AGSSOCK_NO_ERROR);
+			// Note: the pool may have finished already
+			EXPECT(Call<ags_t>("Socket::get_Connecting", clients[i].get())
+				|| Call<ags_t>("Socket::get_Connected", clients[i].get()));
+		}
+		EXPECT(Call<ags_t>("Socket::Send^1", clients[i].get(), "hello"));
+	}
+
+	auto deadline = steady_clock::now() + seconds(5);
+	for (size_t i = 0; i < COUNT; ++i)
+		while (Call<ags_t>("Socket::get_Connecting", clients[i].get())
+			&& steady_clock::now() < deadline)
+			Call<Socket *>("Socket::WaitAny^1", (ags_t) 100);
+
+	for (size_t i = 0; i < COUNT; ++i)
+	{
+		EXPECT(Call<ags_t>("Socket::get_Connected", clients[i].get()));
+		EXPECT(Call<ags_t>("Socket::Connect^2", clients[i].get(), addr.get(),
+			(ags_t) 1));
+
+		Handle<Socket> conn;
+		while (!conn && steady_clock::now() < deadline)
+			if (Call<ags_t>("Socket::Wait^1", server.get(), (ags_t) 100))
+				conn = Call<Socket *>("Socket::Accept^0", server.get());
+		EXPECT(!!conn);
+		EXPECT(Call<ags_t>("Socket::get_Connected", conn.get()));
+
+		string msg;
+		while (msg.size() < 5 && steady_clock::now() < deadline)
+			if (Call<ags_t>("Socket::Wait^1", conn.get(), (ags_t) 100))
+			{
+				Handle<const char> part = Call<const char *>("Socket::Recv^0",
+					conn.get());
+				EXPECT(part);
+				msg += part.get();
+			}
+		EXPECT(msg == "hello");
+		Call<void>("Socket::Close^0", conn.get());
+	}
+
+	for (size_t i = 0; i < COUNT; ++i)
+		Call<void>("Socket::Close^0", clients[i].get());
+	Call<void>("Socket::Close^0", server.get());
+
+	// A refused connection is reported by Wait and then by Connect
+	Handle<Socket> client = Call<Socket *>("Socket::CreateTCP^0");
+	if (!Call<ags_t>("Socket::Connect^2", client.get(), addr.get(), (ags_t) 1))
+	{
+		EXPECT(Call<ags_t>("Socket::ErrorValue^0", client.get()) == AGSSOCK_NO_ERROR);
+		EXPECT(Call<ags_t>("Socket::Wait^1", client.get(), (ags_t) 5000));
+		EXPECT(!Call<ags_t>("Socket::get_Connecting", client.get()));
+		EXPECT(!Call<ags_t>("Socket::Connect^2", client.get(), addr.get(),
+			(ags_t) 1));
+	}
+	EXPECT(!Call<ags_t>("Socket::get_Connected", client.get()));
+	EXPECT(Call<ags_t>("Socket::ErrorValue^0", client.get()) != AGSSOCK_NO_ERROR);
+
+	return true;
+});
+
+//------------------------------------------------------------------------------
+
+Test test15("connecting by name", []()
+{
+	using namespace AGSMock;
+	using namespace std::chrono;
+
+	cout << endl;
+
+	Handle<Socket> server = Call<Socket *>("Socket::CreateTCP^0");
+	Handle<Socket> client = Call<Socket *>("Socket::CreateTCP^0");
+	string address;
+	ags_t port;
+
+	{
+		Handle<SockAddr> addr = Call<SockAddr *>("SockAddr::CreateIP^2",
+			"127.0.0.1", (ags_t) 0);
+		EXPECT(Call<ags_t>("Socket::Bind^1", server.get(), addr.get()));
+		EXPECT(Call<ags_t>("Socket::Listen^1", server.get(), (ags_t) 10));
+		addr = Call<SockAddr *>("Socket::get_Local", server.get());
+		port = Call<ags_t>("SockAddr::get_Port", addr.get());
+		address = "localhost:" + std::to_string(port);
+	}
+
+	// Addresses asked for before connecting are kept up to date
+	Handle<SockAddr> local = Call<SockAddr *>("Socket::get_Local", client.get());
+	Handle<SockAddr> remote = Call<SockAddr *>("Socket::get_Remote", client.get());
+	EXPECT(Call<ags_t>("SockAddr::get_Port", local.get()) == 0);
+
+	// The host is looked up and connected to in the background
+	EXPECT(!Call<ags_t>("Socket::ConnectByName^1", client.get(), address.c_str()));
+	EXPECT(Call<ags_t>("Socket::ErrorValue^0", client.get()) == AGSSOCK_NO_ERROR);
+	EXPECT(Call<ags_t>("Socket::Send^1", client.get(), "hello"));
+
+	auto deadline = steady_clock::now() + seconds(5);
+	while (Call<ags_t>("Socket::get_Connecting", client.get())
+		&& steady_clock::now() < deadline)
+		Call<ags_t>("Socket::Wait^1", client.get(), (ags_t) 100);
+	EXPECT(Call<ags_t>("Socket::get_Connected", client.get()));
+	EXPECT(Call<ags_t>("Socket::ConnectByName^1", client.get(), address.c_str()));
+	EXPECT(Call<ags_t>("SockAddr::get_Port", local.get()) != 0);
+	EXPECT(Call<ags_t>("SockAddr::get_Port", remote.get()) == port);
+
+	Handle<Socket> conn;
+	while (!conn && steady_clock::now() < deadline)
+		if (Call<ags_t>("Socket::Wait^1", server.get(), (ags_t) 100))
+			conn = Call<Socket *>("Socket::Accept^0", server.get());
+	EXPECT(!!conn);
+
+	string msg;
+	while (msg.size() < 5 && steady_clock::now() < deadline)
+		if (Call<ags_t>("Socket::Wait^1", conn.get(), (ags_t) 100))
+		{
+			Handle<const char> part = Call<const char *>("Socket::Recv^0",
+				conn.get());
+			EXPECT(part);
+			msg += part.get();
+		}
+	EXPECT(msg == "hello");
+
+	Call<void>("Socket::Close^0", conn.get());
+	Call<void>("Socket::Close^0", client.get());
+	Call<void>("Socket::Close^0", server.get());
+
+	// Once every address refused, the last error is reported
+	Handle<Socket> refused = Call<Socket *>("Socket::CreateTCP^0");
+	EXPECT(!Call<ags_t>("Socket::ConnectByName^1", refused.get(), address.c_str()));
+	while (Call<ags_t>("Socket::get_Connecting", refused.get())
+		&& steady_clock::now() < deadline)
+		Call<ags_t>("Socket::Wait^1", refused.get(), (ags_t) 100);
+	EXPECT(!Call<ags_t>("Socket::get_Connected", refused.get()));
+	EXPECT(!Call<ags_t>("Socket::ConnectByName^1", refused.get(), address.c_str()));
+	EXPECT(Call<ags_t>("Socket::ErrorValue^0", refused.get()) == AGSSOCK_DISCONNECTED);
+
+	// Datagram sockets are asked to try again while the host is looked up
+	Handle<Socket> udp = Call<Socket *>("Socket::CreateUDP^0");
+	ags_t connected = 0;
+	while (!connected && steady_clock::now() < deadline)
+	{
+		connected = Call<ags_t>("Socket::ConnectByName^1", udp.get(),
+			address.c_str());
+		EXPECT(connected || Call<ags_t>("Socket::ErrorValue^0", udp.get())
+			== AGSSOCK_NO_ERROR);
+		if (!connected)
+			m_sleep(10);
+	}
+	EXPECT(connected);
+
+	return true;
+});
+
+//------------------------------------------------------------------------------
+
+Test test16("closing in the background", []()
+{
+	using namespace AGSMock;
+	using namespace std::chrono;
+
+	cout << endl;
+
+	Handle<Socket> server = Call<Socket *>("Socket::CreateTCP^0");
+	Handle<Socket> client = Call<Socket *>("Socket::CreateTCP^0");
+
+	{
+		Handle<SockAddr> addr = Call<SockAddr *>("SockAddr::CreateIP^2",
+			"127.0.0.1", (ags_t) 0);
+		EXPECT(Call<ags_t>("Socket::Bind^1", server.get(), addr.get()));
+		EXPECT(Call<ags_t>("Socket::Listen^1", server.get(), (ags_t) 10));
+		addr = Call<SockAddr *>("Socket::get_Local", server.get());
+		EXPECT(Call<ags_t>("Socket::Connect^2", client.get(), addr.get(),
+			(ags_t) 0));
+	}
+
+	Handle<Socket> conn;
+	auto deadline = steady_clock::now() + seconds(5);
+	while (!conn && steady_clock::now() < deadline)
+		if (Call<ags_t>("Socket::Wait^1", server.get(), (ags_t) 100))
+			conn = Call<Socket *>("Socket::Accept^0", server.get());
+	EXPECT(!!conn);
+
+	// The linger time is a plugin option, which accepted sockets inherit
+	EXPECT(Call<ags_t>("Socket::GetOption^2", client.get(),
+		(ags_t) AGSSOCK_LEVEL, (ags_t) AGSSOCK_LINGER) > 0);
+	EXPECT(!Call<ags_t>("Socket::SetOption^3", client.get(),
+		(ags_t) AGSSOCK_LEVEL, (ags_t) AGSSOCK_LINGER, (ags_t) -1));
+	EXPECT(Call<ags_t>("Socket::ErrorValue^0", client.get()) == AGSSOCK_INVALID);
+	EXPECT(Call<ags_t>("Socket::SetOption^3", client.get(),
+		(ags_t) AGSSOCK_LEVEL, (ags_t) AGSSOCK_LINGER, (ags_t) 2000));
+	EXPECT(Call<ags_t>("Socket::GetOption^2", client.get(),
+		(ags_t) AGSSOCK_LEVEL, (ags_t) AGSSOCK_LINGER) == 2000);
+
+	// Data that arrived before closing can still be read after
+	EXPECT(Call<ags_t>("Socket::Send^1", conn.get(), "early"));
+	while (!Call<ags_t>("Socket::get_Pending", client.get())
+		&& steady_clock::now() < deadline)
+		Call<ags_t>("Socket::Wait^1", client.get(), (ags_t) 100);
+
+	// Closing returns right away, even though the remote host has yet to
+	// close and data is still queued
+	Call<void>("Socket::set_ReceiveLimit", conn.get(), (ags_t) 65536);
+	string block(1 << 20, 'C');
+	EXPECT(Call<ags_t>("Socket::Send^1", client.get(), block.c_str()));
+	auto start = steady_clock::now();
+	Call<void>("Socket::Close^0", client.get());
+	EXPECT(steady_clock::now() - start < milliseconds(100));
+	EXPECT(!Call<ags_t>("Socket::get_Valid", client.get()));
+	EXPECT(Call<ags_t>("Socket::ErrorValue^0", client.get()) == AGSSOCK_NO_ERROR);
+	EXPECT(Call<ags_t>("Socket::get_Unsent", client.get()) == 0);
+	{
+		Handle<const char> msg = Call<const char *>("Socket::Recv^0",
+			client.get());
+		EXPECT(msg && string(msg.get()) == "early");
+	}
+
+	// The pool sends the rest, then the end of the stream
+	long received = 0;
+	bool eof = false;
+	while (!eof && steady_clock::now() < deadline)
+	{
+		if (!Call<ags_t>("Socket::Wait^1", conn.get(), (ags_t) 100))
+			continue;
+		Handle<SockData> data = Call<SockData *>("Socket::RecvData^0",
+			conn.get());
+		if (!data)
+			continue;
+		ags_t size = Call<ags_t>("SockData::get_Size", data.get());
+		eof = (size == 0);
+		received += size;
+	}
+	EXPECT(eof);
+	EXPECT(received == (long) block.size());
+
+	// Once the remote host closes as well the connection is gone for good,
+	// which the pool learns about without the script
+	Call<void>("Socket::Close^0", conn.get());
+	EXPECT(!Call<ags_t>("Socket::get_Valid", conn.get()));
+
+	// Without lingering a connection is closed right away
+	client = Call<Socket *>("Socket::CreateTCP^0");
+	{
+		Handle<SockAddr> addr = Call<SockAddr *>("Socket::get_Local",
+			server.get());
+		EXPECT(Call<ags_t>("Socket::Connect^2", client.get(), addr.get(),
+			(ags_t) 0));
+	}
+	conn.reset();
+	while (!conn && steady_clock::now() < deadline)
+		if (Call<ags_t>("Socket::Wait^1", server.get(), (ags_t) 100))
+			conn = Call<Socket *>("Socket::Accept^0", server.get());
+	EXPECT(!!conn);
+	EXPECT(Call<ags_t>("Socket::SetOption^3", client.get(),
+		(ags_t) AGSSOCK_LEVEL, (ags_t) AGSSOCK_LINGER, (ags_t) 0));
+	Call<void>("Socket::Close^0", client.get());
+	EXPECT(!Call<ags_t>("Socket::get_Valid", client.get()));
+	while (Call<ags_t>("Socket::get_Valid", conn.get())
+		&& steady_clock::now() < deadline)
+		if (Call<ags_t>("Socket::Wait^1", conn.get(), (ags_t) 100))
+		{
+			Handle<const char> msg = Call<const char *>("Socket::Recv^0",
+				conn.get());
+		}
+	EXPECT(!Call<ags_t>("Socket::get_Valid", conn.get()));
+
+	Call<void>("Socket::Close^0", conn.get());
+	Call<void>("Socket::Close^0", server.get());
+
+	return true;
+});
+
+//------------------------------------------------------------------------------
+
 int main(int argc, char const *argv[])
 {
 	AGSMock::Initialize();